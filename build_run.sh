@@ -1,4 +1,4 @@
-gcc src/main.c -o bin/shell
+gcc src/main.c -o bin/shell -pthread
 gcc src/echo.c -o bin/echo
 clear
 ./bin/shell
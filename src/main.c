@@ -7,6 +7,8 @@
  * 28 July 2020
  *
  * NOTE: This source code has not been separated into multiple files to facilitate the compilation process.
+ *       Define SMALL_SHELL_NO_MAIN before including this file to use its features without the main function
+ *       (this is how 'tools/bench.c' links against the shell internals).
  *
  * This code file is organized into sections:
  *
@@ -14,9 +16,18 @@
  *      2 - Small lexer features
  *      3 - Parsing features
  *      4 - Command features
- *      5 - Main function
+ *      5 - Glob features
+ *      6 - State image features
+ *      7 - Warm pool features
+ *      8 - Directory cache features
+ *      9 - History and line editing features
+ *     10 - Expression features
+ *     11 - Control flow features
+ *     12 - Main function
  */
 
+#define _GNU_SOURCE //enables 'F_SETPIPE_SZ'
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +38,47 @@
 #include <fcntl.h> //flags used in 'open' syscall
 #include <dirent.h> //contains 'dirent' syscall constants
 #include <wait.h> //contains 'wait'
+#include <errno.h> //contains 'errno' and its values
+#include <sys/stat.h> //contains 'fstat'
+#include <sys/mman.h> //contains 'mmap' and 'mremap'
+#include <termios.h> //terminal raw mode (line editor)
+#include <sys/inotify.h> //contains 'inotify' syscalls (directory cache)
+#include <pthread.h> //threads of the '**' glob walk
+#include <sys/sendfile.h> //contains 'sendfile' (CAT command)
+#include <sched.h> //contains 'sched_setaffinity' and the scheduling policies
+#include <sys/resource.h> //contains 'getpriority'
+#include <limits.h> //contains 'PATH_MAX'
+#include <stdint.h> //fixed-size integers of the state images
+#include <sys/uio.h> //contains 'writev'
+#include <sys/socket.h> //control sockets of the warm helpers
+#include <sys/prctl.h> //contains 'prctl' (PR_SET_PDEATHSIG)
+#include <signal.h> //contains 'kill'
+#include <sys/timerfd.h> //ticks of the WATCH command
+#include <poll.h> //contains 'poll'
+#include <sys/ioctl.h> //contains 'ioctl' (terminal size)
+#include <time.h> //contains 'clock_gettime'
+#include <stdarg.h> //variadic error messages
+
+extern char **environ; //environment of the shell process
+
+int last_status = 0; //exit status of the last command (0 on success)
+
+/**
+ * @brief Print an error message (printf format) of the running command to the standard error stream
+ *        (redirected by '2>' for builtins too) and make its exit status 1 (failure).
+ */
+void command_error(const char *format, ...)
+{
+    va_list args;
+
+    fflush(stdout); //the message comes after the output already printed
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+
+    last_status = EXIT_FAILURE;
+}
 
 // ==========================================================
 // =============== CMD_LINE_T OBJECT FEATURES ===============
@@ -34,25 +86,113 @@
 
 #define MAX_TOKEN_LEN 500 //Maximun length for a token
 
+/**
+ * @brief Growable storage of strings: an arena with the strings and the offset of each one.
+ *        It is used for the arguments created by the glob expansion of a command line.
+ * @param data         Arena with the null-terminated strings.
+ * @param len          Used bytes of the arena.
+ * @param cap          Capacity of the arena.
+ * @param offsets      Offset of each string in the arena.
+ * @param n_offsets    Number of strings.
+ * @param cap_offsets  Capacity of the offsets array.
+ */
+typedef struct
+{
+    char *data;
+    size_t len, cap;
+    size_t *offsets;
+    size_t n_offsets, cap_offsets;
+} arg_storage_t;
+
+/**
+ * @brief Redirection of a standard stream of a command ('> path', '>> path', '< path', '2> path' or '2>&1').
+ * @param fd      Redirected descriptor (0, 1 or 2).
+ * @param flags   Flags of the 'open' syscall for the target file.
+ * @param target  Path token of the target file ($varname or text, owned by the struct), "&1" for '2>&1'
+ *                or NULL if it is missing.
+ */
+typedef struct
+{
+    int fd;
+    int flags;
+    char *target;
+} redirect_t;
+
 /**
  * @brief Struct that contains the command and the arguments for each line typed by the user.
- * @param args    Array of pointers of argument strings.
- * @param nargs   Number of arguments.
+ *        The typed arguments are kept in 'tokens'. The 'args' array seen by the commands points to the
+ *        tokens or, after the expansion, directly to the contents of the variables (no copies), to the
+ *        captured outputs of the command substitutions and to the glob matches in 'storage'.
+ * @param args        Array of pointers of argument strings (views).
+ * @param nargs       Number of arguments.
+ * @param cap_args    Capacity of the args array.
+ * @param tokens      Array of typed argument strings (owned by the struct).
+ * @param n_tokens    Number of tokens.
+ * @param slots       Variable node of each '$varname' token (resolved on the first expansion).
+ * @param outputs     Captured output of each '$(command)' token (owned by the struct, NULL for other tokens).
+ * @param patterns    Compiled pattern of each glob token (compiled on the first expansion).
+ * @param storage     Glob matches of the last expansion.
+ * @param n_dynamic   Number of '$(command)' and glob tokens, which must be expanded again on each run.
+ * @param generation  Variables generation of the last expansion (0 if the args have not been expanded).
+ * @param redirects   Redirections of the standard streams, in the typed order (they are not tokens).
+ * @param n_redirects Number of redirections.
+ * @param next_op     Operator between this command and the next command of its line (LIST_*).
  */
 typedef struct
 {
     char *command; //command string
     char **args; //array of argument strings
     size_t nargs; //number of arguments
+    size_t cap_args; //capacity of the args array
+    char **tokens; //array of typed argument strings
+    size_t n_tokens; //number of tokens
+    struct alphabetical_tree_node **slots; //variable nodes of '$varname' tokens
+    char **outputs; //captured outputs of '$(command)' tokens
+    struct glob_pattern **patterns; //compiled patterns of glob tokens
+    arg_storage_t storage; //glob matches
+    size_t n_dynamic; //number of '$(command)' and glob tokens
+    unsigned long generation; //variables generation of the last expansion
+    redirect_t *redirects; //redirections of the standard streams
+    size_t n_redirects; //number of redirections
+    int next_op; //operator before the next command of the line
 } cmd_line_t;
 
+#define LIST_END 0 //last command of the line
+#define LIST_SEQ 1 //';': the next command always runs
+#define LIST_AND 2 //'&&': the next command runs if this command succeeds
+#define LIST_OR 3  //'||': the next command runs if this command fails
+
+/**
+ * @brief Commands of a line ('cmd ; cmd && cmd || cmd'), parsed once and dispatched in order.
+ * @param cmds      Array of the cmd_line buffers (owned by the list, NULL if taken by a program).
+ * @param n_cmds    Number of commands.
+ * @param cap_cmds  Capacity of the cmds array.
+ */
+typedef struct
+{
+    cmd_line_t **cmds;
+    size_t n_cmds, cap_cmds;
+} cmd_list_t;
+
+void destroy_glob_pattern(struct glob_pattern *pattern); //defined in the glob features
+
+/**
+ * @brief Check if an argument token must be expanded again on each run ('$(command)' or glob pattern).
+ */
+int dynamic_token(char *token)
+{
+    if(token[0] == '$') return token[1] == '('; //command substitution (variables are not dynamic)
+
+    return strpbrk(token, "*?[") != NULL; //glob pattern
+}
+
 /**
  * @brief Creates an empty cmd_line_t struct buffer.
  * @return Pointer to the cmd_line_t struct buffer.
  */
 cmd_line_t* create_cmd_line()
 {
-    cmd_line_t* my_cmd_line = (cmd_line_t*)malloc(sizeof(cmd_line_t));
+    cmd_line_t* my_cmd_line = (cmd_line_t*)calloc(1, sizeof(cmd_line_t));
     assert(my_cmd_line != NULL);
 
     //set command
@@ -63,6 +203,21 @@ cmd_line_t* create_cmd_line()
 
     //set nargs as 0
     my_cmd_line->nargs = 0;
+    my_cmd_line->cap_args = 0;
+
+    //set tokens and their expansion data as NULL
+    my_cmd_line->tokens = NULL;
+    my_cmd_line->n_tokens = 0;
+    my_cmd_line->slots = NULL;
+    my_cmd_line->outputs = NULL;
+    my_cmd_line->patterns = NULL;
+    my_cmd_line->n_dynamic = 0;
+
+    //not expanded yet
+    my_cmd_line->generation = 0;
+
+    //alone in its line until an operator is read
+    my_cmd_line->next_op = LIST_END;
 
     return  my_cmd_line;
 }
@@ -80,12 +235,37 @@ void set_cmd_line_command(cmd_line_t *cmd_line, char *command)
     if (cmd_line->command != NULL) //if cmd_line already have a command string buffer
         free(cmd_line->command); //destroy it
 
-    cmd_line->command = calloc(strlen(command), sizeof(char)); //create a new buffer to 'command' in cmd_line
+    cmd_line->command = calloc(strlen(command)+1, sizeof(char)); //create a new buffer to 'command' in cmd_line
     assert(cmd_line->command != NULL);
 
     strcpy(cmd_line->command, command);  //copy text from 'command' to 'cmd_line->command'
 }
 
+/**
+ * @brief Free the tokens of the cmd_line buffer with their expansion data.
+ * @param cmd_line    Pointer to the working cmd_line_t struct buffer
+ */
+void free_cmd_line_tokens(cmd_line_t *cmd_line)
+{
+    for (size_t i = 0; i < cmd_line->n_tokens; i++)
+    {
+        if(cmd_line->tokens[i] != NULL) //if 'tokens[i]' have a buffer
+            free(cmd_line->tokens[i]); //destroy it
+
+        if(cmd_line->outputs[i] != NULL) //if 'outputs[i]' have a buffer
+            free(cmd_line->outputs[i]); //destroy it
+
+        if(cmd_line->patterns[i] != NULL) //if 'patterns[i]' have been compiled
+            destroy_glob_pattern(cmd_line->patterns[i]); //destroy it
+    }
+
+    free(cmd_line->args); //destroy the 'args' array buffer
+    free(cmd_line->tokens); //destroy the 'tokens' array buffer
+    free(cmd_line->slots); //destroy the 'slots' array buffer
+    free(cmd_line->outputs); //destroy the 'outputs' array buffer
+    free(cmd_line->patterns); //destroy the 'patterns' array buffer
+}
+
 /**
  * @brief Initialize the arguments array of the cmd_line buffer
  * @param cmd_line    Pointer to the working cmd_line_t struct buffer
@@ -97,12 +277,28 @@ void init_cmd_line_args(cmd_line_t *cmd_line, size_t nargs)
     assert(nargs > 0);
 
     if(cmd_line->args != NULL) //if cmd_line already have an 'args' buffer
-        free(cmd_line->args);  //destroy it
+        free_cmd_line_tokens(cmd_line); //destroy it
 
     cmd_line->args = calloc(nargs, sizeof(char*)); //create a new buffer to 'cmd_line->args'
     assert(cmd_line->args != NULL);
 
+    cmd_line->tokens = calloc(nargs, sizeof(char*)); //create a new buffer to 'cmd_line->tokens'
+    assert(cmd_line->tokens != NULL);
+
+    cmd_line->slots = calloc(nargs, sizeof(struct alphabetical_tree_node*)); //create a new buffer to 'cmd_line->slots'
+    assert(cmd_line->slots != NULL);
+
+    cmd_line->outputs = calloc(nargs, sizeof(char*)); //create a new buffer to 'cmd_line->outputs'
+    assert(cmd_line->outputs != NULL);
+
+    cmd_line->patterns = calloc(nargs, sizeof(struct glob_pattern*)); //create a new buffer to 'cmd_line->patterns'
+    assert(cmd_line->patterns != NULL);
+
     cmd_line->nargs = nargs;
+    cmd_line->cap_args = nargs;
+    cmd_line->n_tokens = nargs;
+    cmd_line->n_dynamic = 0;
+    cmd_line->generation = 0;
 }
 
 /**
@@ -115,15 +311,40 @@ void set_cmd_line_arg(cmd_line_t *cmd_line, char* arg, size_t argi)
 {
     assert(cmd_line != NULL);
     assert(arg != NULL);
-    assert(argi >= 0 && argi < cmd_line->nargs);
+    assert(argi >= 0 && argi < cmd_line->n_tokens);
+
+    char *token = calloc(strlen(arg)+1, sizeof(char)); //create a new buffer to the arg
+    assert(token != NULL);
+
+    strcpy(token, arg); //copy text from 'arg' to the buffer (before freeing, because 'arg' can be a view of the old token)
+
+    if(cmd_line->tokens[argi] != NULL) //if 'tokens[argi]' already have a buffer
+    {
+        if(dynamic_token(cmd_line->tokens[argi])) cmd_line->n_dynamic--;
+        free(cmd_line->tokens[argi]);  //destroy it
+    }
 
-    if(cmd_line->args[argi] != NULL) //if 'args[argi]' already have a buffer
-        free(cmd_line->args[argi]);  //destroy it
+    if(cmd_line->patterns[argi] != NULL) //pattern of the old token
+    {
+        destroy_glob_pattern(cmd_line->patterns[argi]);
+        cmd_line->patterns[argi] = NULL;
+    }
 
-    cmd_line->args[argi] = calloc(strlen(arg), sizeof(char)); //create a new buffer to the arg
-    assert(cmd_line->args[argi] != NULL);
+    if(dynamic_token(token)) cmd_line->n_dynamic++; //command substitution or glob pattern
 
-    strcpy(cmd_line->args[argi], arg); //copy text from 'arg' to the buffer
+    cmd_line->tokens[argi] = token;
+    cmd_line->slots[argi] = NULL;
+    cmd_line->generation = 0;
+
+    //not expanded yet: the args are the tokens
+    if(cmd_line->nargs == cmd_line->n_tokens)
+        cmd_line->args[argi] = token;
+    else
+    {
+        for(size_t i = 0; i < cmd_line->n_tokens; i++)
+            cmd_line->args[i] = cmd_line->tokens[i];
+        cmd_line->nargs = cmd_line->n_tokens;
+    }
 }
 
 /**
@@ -138,19 +359,116 @@ void destroy_cmd_line(cmd_line_t* cmd_line)
         free(cmd_line->command); //destroy 'command' string buffer
 
     if(cmd_line->args != NULL) //if cmd_line have a buffer to the 'args' array
-    {
-        for (size_t i = 0; i < cmd_line->nargs; i++)
-        {
-            if(cmd_line->args[i] != NULL) //if 'args[i]' have a buffer
-                free(cmd_line->args[i]); //destroy it
-        }
+        free_cmd_line_tokens(cmd_line); //destroy the tokens and the arrays
 
-        free(cmd_line->args); //destroy the 'args' array buffer
-    }
+    free(cmd_line->storage.data); //destroy the glob matches
+    free(cmd_line->storage.offsets);
+
+    for(size_t i = 0; i < cmd_line->n_redirects; i++)
+        free(cmd_line->redirects[i].target); //destroy the redirection targets
+    free(cmd_line->redirects);
 
     free(cmd_line); //destroy the struct
 }
 
+/**
+ * @brief Creates an empty command list.
+ * @return Pointer to the cmd_list_t struct buffer.
+ */
+cmd_list_t *create_cmd_list()
+{
+    cmd_list_t *list = (cmd_list_t*)calloc(1, sizeof(cmd_list_t));
+    assert(list != NULL);
+
+    return list;
+}
+
+/**
+ * @brief Append a command to the list (the list takes the cmd_line buffer).
+ * @param list      Pointer to the working cmd_list_t struct buffer
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer
+ */
+void append_cmd_list(cmd_list_t *list, cmd_line_t *cmd_line)
+{
+    assert(list != NULL);
+    assert(cmd_line != NULL);
+
+    if(list->n_cmds == list->cap_cmds)
+    {
+        list->cap_cmds = list->cap_cmds == 0 ? 4 : list->cap_cmds * 2;
+        list->cmds = (cmd_line_t**)realloc(list->cmds, list->cap_cmds * sizeof(cmd_line_t*));
+        assert(list->cmds != NULL);
+    }
+
+    list->cmds[list->n_cmds++] = cmd_line;
+}
+
+/**
+ * @brief Free the command list with the cmd_line buffers it still owns.
+ * @param list  Pointer to the working cmd_list_t struct buffer
+ */
+void destroy_cmd_list(cmd_list_t *list)
+{
+    assert(list != NULL);
+
+    for(size_t i = 0; i < list->n_cmds; i++)
+        if(list->cmds[i] != NULL) destroy_cmd_line(list->cmds[i]);
+
+    free(list->cmds);
+    free(list);
+}
+
+/**
+ * @brief Remove an argument token of the cmd_line buffer (before its expansion).
+ * @param cmd_line    Pointer to the working cmd_line_t struct buffer
+ * @param argi        Index of the token
+ */
+void remove_cmd_line_arg(cmd_line_t *cmd_line, size_t argi)
+{
+    assert(cmd_line != NULL);
+    assert(argi < cmd_line->n_tokens);
+
+    if(dynamic_token(cmd_line->tokens[argi])) cmd_line->n_dynamic--;
+    free(cmd_line->tokens[argi]);
+    free(cmd_line->outputs[argi]);
+    if(cmd_line->patterns[argi] != NULL) destroy_glob_pattern(cmd_line->patterns[argi]);
+
+    //shift the next tokens with their expansion data
+    size_t n_next = cmd_line->n_tokens - argi - 1;
+    memmove(&cmd_line->tokens[argi], &cmd_line->tokens[argi+1], n_next * sizeof(char*));
+    memmove(&cmd_line->slots[argi], &cmd_line->slots[argi+1], n_next * sizeof(struct alphabetical_tree_node*));
+    memmove(&cmd_line->outputs[argi], &cmd_line->outputs[argi+1], n_next * sizeof(char*));
+    memmove(&cmd_line->patterns[argi], &cmd_line->patterns[argi+1], n_next * sizeof(struct glob_pattern*));
+    cmd_line->n_tokens--;
+
+    //not expanded yet: the args are the tokens
+    for(size_t i = 0; i < cmd_line->n_tokens; i++)
+        cmd_line->args[i] = cmd_line->tokens[i];
+    cmd_line->nargs = cmd_line->n_tokens;
+    cmd_line->generation = 0;
+}
+
+/**
+ * @brief Add a redirection to the cmd_line buffer.
+ * @param cmd_line    Pointer to the working cmd_line_t struct buffer
+ * @param fd          Redirected descriptor (0, 1 or 2)
+ * @param flags       Flags of the 'open' syscall for the target file
+ * @param target      Target token (copied), or NULL if it is missing
+ */
+void add_cmd_line_redirection(cmd_line_t *cmd_line, int fd, int flags, char *target)
+{
+    assert(cmd_line != NULL);
+
+    cmd_line->redirects = (redirect_t*)realloc(cmd_line->redirects, (cmd_line->n_redirects+1) * sizeof(redirect_t));
+    assert(cmd_line->redirects != NULL);
+
+    redirect_t *redirect = &cmd_line->redirects[cmd_line->n_redirects++];
+    redirect->fd = fd;
+    redirect->flags = flags;
+    redirect->target = target != NULL ? strdup(target) : NULL;
+    assert(target == NULL || redirect->target != NULL);
+}
+
 // ====================================================
 // =============== SMALL LEXER FEATURES ===============
 // ====================================================
@@ -186,42 +504,85 @@ int blank_string(char *str)
 }
 
 /**
- * @brief Rrompt the terminal to reading a line of the tty. Return the first remaining token in stdin.
- * @param str    Pointer to the string buffer where the text will be stored.
- * @return 1 (true) if the obtained token is the last of the line in stdin. Otherwise, returns 0 (false).
+ * @brief Get the list operator of a token.
+ * @param token  Token.
+ * @return LIST_SEQ for ';', LIST_AND for '&&', LIST_OR for '||', or LIST_END for the other tokens.
+ */
+int list_operator(char *token)
+{
+    if(!strcmp(token, ";")) return LIST_SEQ;
+    if(!strcmp(token, "&&")) return LIST_AND;
+    if(!strcmp(token, "||")) return LIST_OR;
+    return LIST_END;
+}
+
+/**
+ * @brief Return the first remaining token of the line in the input stream (the tty, for the typed lines).
+ *        A '$(command)' token is read until its closing parenthesis, with its spaces.
+ *        The list operators (';', '&&' and '||') are tokens even without spaces around them.
+ * @param in     Input stream.
+ * @param str    Pointer to the string buffer where the text will be stored (it must start empty).
+ * @return 1 (true) if the obtained token is the last of the line in the input. Otherwise, returns 0 (false).
  */
-int read_token(char *str)
+int read_token(FILE *in, char *str)
 {
+    assert(in != NULL);
     assert(str != NULL);
 
-    char c[2];
-    c[0] = getchar(); //get the first char
-    c[1] = '\0'; //end of string
+    int c = getc(in); //get the first char
 
-    while (c[0] == ' ' || c[0] == '\t') c[0] = getchar(); //jump spaces and tabs
+    while (c == ' ' || c == '\t') c = getc(in); //jump spaces and tabs
 
-    // now, c[0] is the first char of the token
+    // now, c is the first char of the token
 
     size_t token_len = 0;
+    int depth = 0; //parentheses depth inside a '$(command)' token
 
-    while (c[0] != '\n' && c[0] != ' ' && c[0] != '\t') //the token ends with '\n' or space or tab
+    //the token ends with '\n' or end of input or space or tab (outside of parentheses)
+    while (c != '\n' && c != EOF && (depth > 0 || (c != ' ' && c != '\t')))
     {
-        strcat(str,c); //append the last obtained char to string
-        token_len += 1; //increment the token lenght
-        c[0] = getchar(); //read the next char in stdin
-    }
+        if(depth == 0 && (c == ';' || c == '&' || c == '|'))
+        {
+            int next = c == ';' ? c : getc(in);
+
+            if(next == c) //list operator
+            {
+                if(token_len > 0) //it is the next token (glibc streams keep more than one char of pushback)
+                {
+                    if(c != ';') ungetc(next, in);
+                    ungetc(c, in);
+                    return 0;
+                }
+
+                str[0] = c;
+                str[1] = c == ';' ? '\0' : c;
+                str[2] = '\0';
+                return 0;
+            }
+
+            ungetc(next, in); //a single '&' or '|' is a char of the token
+        }
+
+        if(c == '(' && (depth > 0 || (token_len == 1 && str[0] == '$'))) depth++;
+        else if(c == ')' && depth > 0) depth--;
+
+        assert(token_len < MAX_TOKEN_LEN - 1);
 
-    assert(token_len < MAX_TOKEN_LEN);
+        str[token_len++] = c; //append the last obtained char to string
+        str[token_len] = '\0';
+        c = getc(in); //read the next char in the input
+    }
 
-    return c[0] == '\n'; //return true if the obtained token is the last of the line in stdin
+    return c == '\n' || c == EOF; //return true if the obtained token is the last of the line in the input
 }
 
 /**
- * @brief Prompt the terminal to reading a line of the tty. Put the tokens read at the args array of cmd_line.
+ * @brief Read the remaining tokens of a line in the input stream. Put them at the args array of cmd_line.
+ * @param in          Input stream.
  * @param cmd_line    Pointer to the working cmd_line_t struct buffer.
  * @param argi        Index of the argument read in each recursive call. It must start at 0.
  */
-void read_args(cmd_line_t* cmd_line, size_t argi)
+void read_args(FILE *in, cmd_line_t* cmd_line, size_t argi)
 {
     assert(cmd_line != NULL);
     assert(argi >= 0);
@@ -233,18 +594,28 @@ void read_args(cmd_line_t* cmd_line, size_t argi)
 
     do
     {
-        end_of_line = read_token(str);
+        end_of_line = read_token(in, str);
         is_blank = blank_string(str);
+
+        int op = list_operator(str);
+        if(op != LIST_END) //the command ends before the operator
+        {
+            cmd_line->next_op = op;
+            end_of_line = is_blank = 1;
+        }
     }while (is_blank && !end_of_line);
 
-    if(!end_of_line) //if stdin is not empty
+    if(!end_of_line) //if the line is not over
     {
-        read_args(cmd_line, argi+1); //(recursion) go to the next arg
+        read_args(in, cmd_line, argi+1); //(recursion) go to the next arg
     }
     else //exit condition
     {
         if(is_blank && argi > 0)
+        {
             init_cmd_line_args(cmd_line, argi);
+            return; //trailing blanks are not an argument
+        }
         else if(!is_blank && argi >= 0)
             init_cmd_line_args(cmd_line, argi+1);
         else return;
@@ -255,27 +626,183 @@ void read_args(cmd_line_t* cmd_line, size_t argi)
 }
 
 /**
- * @brief Prompt the terminal to reading a line of the tty. Put the tokens read at the cmd_line buffer.
+ * @brief Check if a token begins with a redirection operator ('>', '>>', '<', '2>' or '2>>').
+ * @param token   Token.
+ * @param fd      Pointer to where the redirected descriptor will be stored.
+ * @param flags   Pointer to where the 'open' flags of the target will be stored.
+ * @return Length of the operator, or 0 if the token is not a redirection.
+ */
+size_t redirection_operator(char *token, int *fd, int *flags)
+{
+    size_t len = 0;
+    *fd = STDOUT_FILENO;
+
+    if(token[0] == '2' && token[1] == '>') //stderr
+    {
+        *fd = STDERR_FILENO;
+        len = 1;
+    }
+
+    if(token[len] == '<' && len == 0)
+    {
+        *fd = STDIN_FILENO;
+        *flags = O_RDONLY;
+        return 1;
+    }
+
+    if(token[len] != '>') return 0;
+
+    if(token[len+1] == '>') //append
+    {
+        *flags = O_WRONLY | O_CREAT | O_APPEND;
+        return len+2;
+    }
+
+    *flags = O_WRONLY | O_CREAT | O_TRUNC;
+    return len+1;
+}
+
+/**
+ * @brief Move the redirections of the tokens of the cmd_line ('> path' or '>path') to its redirects array.
+ * @param cmd_line    Pointer to the working cmd_line_t struct buffer.
+ */
+void read_redirections(cmd_line_t *cmd_line)
+{
+    size_t i = 0;
+
+    while(i < cmd_line->n_tokens)
+    {
+        int fd, flags;
+        size_t len = redirection_operator(cmd_line->tokens[i], &fd, &flags);
+
+        if(len == 0) //argument
+        {
+            i++;
+            continue;
+        }
+
+        if(cmd_line->tokens[i][len] != '\0') //'>path'
+            add_cmd_line_redirection(cmd_line, fd, flags, &cmd_line->tokens[i][len]);
+        else if(i+1 < cmd_line->n_tokens) //'> path'
+        {
+            add_cmd_line_redirection(cmd_line, fd, flags, cmd_line->tokens[i+1]);
+            remove_cmd_line_arg(cmd_line, i+1);
+        }
+        else //missing path (reported when the command runs)
+            add_cmd_line_redirection(cmd_line, fd, flags, NULL);
+
+        remove_cmd_line_arg(cmd_line, i);
+    }
+}
+
+/**
+ * @brief Read a command of the input stream, until the end of the line or a list operator.
+ *        Put the tokens read at the cmd_line buffer (and the operator in its 'next_op').
+ * @param in          Input stream.
  * @param cmd_line    Pointer to the working cmd_line_t struct buffer.
  */
-void read_cmd_line(cmd_line_t *cmd_line)
+void read_cmd_line(FILE *in, cmd_line_t *cmd_line)
 {
     assert(cmd_line != NULL);
 
     //read command
     char command[MAX_TOKEN_LEN] = "";
-    int end_of_line = read_token(command);
+    int end_of_line = read_token(in, command);
 
     string_to_lower(command);
 
     set_cmd_line_command(cmd_line, command);
 
     //read arguments
-    if (!end_of_line) read_args(cmd_line, 0);
+    if (!end_of_line)
+    {
+        read_args(in, cmd_line, 0);
+        read_redirections(cmd_line);
+    }
+}
+
+int block_keyword(char *command); //defined in the control flow features
+
+/**
+ * @brief Read a line of the input stream with its commands separated by ';', '&&' or '||' (a trailing ';' is allowed).
+ * @param in    Input stream.
+ * @param list  Pointer to the working cmd_list_t struct buffer (it takes the commands read).
+ * @return 1 (true) on success. Otherwise (syntax error, reported), returns 0 (false).
+ */
+int read_cmd_list(FILE *in, cmd_list_t *list)
+{
+    assert(list != NULL);
+
+    while(1)
+    {
+        cmd_line_t *cmd_line = create_cmd_line();
+        read_cmd_line(in, cmd_line);
+
+        cmd_line_t *previous = list->n_cmds > 0 ? list->cmds[list->n_cmds-1] : NULL;
+
+        if(list_operator(cmd_line->command) != LIST_END)
+        {
+            command_error("ERROR: Missing command before \'%s\'\n", cmd_line->command);
+            destroy_cmd_line(cmd_line);
+            return 0;
+        }
+
+        if(cmd_line->command[0] == '\0') //end of the line after an operator
+        {
+            destroy_cmd_line(cmd_line);
+
+            if(previous != NULL && previous->next_op != LIST_SEQ)
+            {
+                command_error("ERROR: Missing command after \'%s\'\n", previous->next_op == LIST_AND ? "&&" : "||");
+                return 0;
+            }
+
+            if(previous != NULL) previous->next_op = LIST_END;
+            return 1;
+        }
+
+        append_cmd_list(list, cmd_line);
+
+        if(cmd_line->next_op == LIST_END) return 1;
+
+        if(block_keyword(cmd_line->command)) //the block body is read from the next lines
+        {
+            command_error("ERROR: The \'%s\' header must be the last command of its line\n", cmd_line->command);
+            return 0;
+        }
+    }
+}
+
+#define LINE_READ 1   //commands have been read
+#define LINE_BLANK 0  //blank line
+#define LINE_ERROR -1 //syntax error (reported)
+#define LINE_END -2   //end of the input
+
+/**
+ * @brief Put the commands of a text line at the cmd_list buffer. The line is lexed once: the commands
+ *        are dispatched from the list.
+ * @param list  Pointer to the working cmd_list_t struct buffer.
+ * @param text  Text of the line.
+ * @return LINE_READ on success, LINE_BLANK for an empty text or LINE_ERROR for a syntax error.
+ */
+int parse_cmd_list(cmd_list_t *list, char *text)
+{
+    assert(list != NULL);
+    assert(text != NULL);
+
+    if(blank_string(text)) return LINE_BLANK;
+
+    FILE *in = fmemopen(text, strlen(text), "r"); //the lexer reads streams
+    assert(in != NULL);
+
+    int parsed = read_cmd_list(in, list);
+    fclose(in);
+
+    return parsed ? LINE_READ : LINE_ERROR;
 }
 
 /**
- * @brief Print the contents of the cmd_line struct buffer.
+ * @brief Print the contents of the cmd_line struct buffer to the standard error stream (after an error message).
  * @param cmd_line    Pointer to the working cmd_line_t struct buffer.
  */
 void print_cmd_line(cmd_line_t *cmd_line)
@@ -283,16 +810,16 @@ void print_cmd_line(cmd_line_t *cmd_line)
     assert(cmd_line != NULL);
 
     if (cmd_line->command != NULL)
-        printf("COMMAND: %s\n", cmd_line->command);
+        fprintf(stderr, "COMMAND: %s\n", cmd_line->command);
 
-    printf("ARGS:\n");
+    fprintf(stderr, "ARGS:\n");
     for(size_t i = 0; i < cmd_line->nargs; i++)
     {
         if(cmd_line->args[i] != NULL)
-            printf("[%d]\t%s\n", i, cmd_line->args[i]);
+            fprintf(stderr, "[%zu]\t%s\n", i, cmd_line->args[i]);
     }
 
-    printf("NARGS: %d\n", cmd_line->nargs);
+    fprintf(stderr, "NARGS: %zu\n", cmd_line->nargs);
 }
 
 // ================================================
@@ -301,6 +828,23 @@ void print_cmd_line(cmd_line_t *cmd_line)
 
 #define ALPHABETICAL_TREE_ENTRIES 26 //Number of output edges for each vertex in the alphabetical tree
 
+#define VALUE_TEXT 0  //text (a number written in a text is parsed only when it is used in arithmetic)
+#define VALUE_INT 1   //64-bit integer
+#define VALUE_FLOAT 2 //double precision float
+
+/**
+ * @brief Typed value of a variable or of an expression.
+ * @param type     VALUE_TEXT, VALUE_INT or VALUE_FLOAT.
+ * @param integer  Number of VALUE_INT values.
+ * @param real     Number of VALUE_FLOAT values.
+ */
+typedef struct
+{
+    int type;
+    long long integer;
+    double real;
+} value_t;
+
 /**
  * @brief Node struct of the alphabetical tree.
  *        This tree serves to store tokens, so that the information of their existence
@@ -311,6 +855,11 @@ void print_cmd_line(cmd_line_t *cmd_line)
  *
  * @param cmd_callback  callback to the function that perform the command (NULL if the command does not exists)
  * @param text          Content text for variables (NULL if the variable does not exists)
+ * @param env_name      Name of the variable in the environment of the programs (NULL if it is not exported)
+ * @param env_index     Index of the variable's entry in the exported envp array (-1 if it has no entry)
+ * @param value         Typed content of the variable. For numbers, 'text' is a buffer of the variable where
+ *                      the number is written when its text is used.
+ * @param text_stale    1 (true) if the number has changed since it was written in 'text'. Otherwise, 0 (false).
  * @param next          Edges for the next tree level.
  */
 typedef struct alphabetical_tree_node
@@ -318,6 +867,10 @@ typedef struct alphabetical_tree_node
     //callback to the function that perform the command (NULL if the command does not exists)
     void (*cmd_callback)(cmd_line_t*);
     char *text;
+    char *env_name;
+    long env_index;
+    value_t value;
+    int text_stale;
 
     struct alphabetical_tree_node *next[ALPHABETICAL_TREE_ENTRIES];
 } alphabetical_tree_node_t;
@@ -357,6 +910,11 @@ alphabetical_tree_node_t *create_alphabetical_tree_node()
     assert(node != NULL);
 
     node->cmd_callback = NULL;
+    node->text = NULL;
+    node->env_name = NULL;
+    node->env_index = -1;
+    node->value.type = VALUE_TEXT;
+    node->text_stale = 0;
 
     for(int i = 0; i < ALPHABETICAL_TREE_ENTRIES; i++)
         node->next[i] = NULL;
@@ -423,31 +981,27 @@ void insert_token_in_tree(alphabetical_tree_header_t *h, char *token, void (*cal
     if(h->entries[j] == NULL)
         h->entries[j] = create_alphabetical_tree_node();
 
-    if(token_len == 1)
-    {
-        h->entries[j]->cmd_callback = callback;
-    }
-    else
+    alphabetical_tree_node_t *iterator = h->entries[j];
+    for(int i = 1; i < token_len; i++)
     {
-        alphabetical_tree_node_t *iterator = h->entries[j];
-        for(int i = 1; i < token_len; i++)
-        {
-            j = token[i] - 'a';
+        j = token[i] - 'a';
 
-            if(iterator->next[j] == NULL)
-                iterator->next[j] = create_alphabetical_tree_node();
+        if(iterator->next[j] == NULL)
+            iterator->next[j] = create_alphabetical_tree_node();
 
-            iterator = iterator->next[j];
-        }
+        iterator = iterator->next[j];
+    }
 
-        iterator->cmd_callback = callback;
+    iterator->cmd_callback = callback;
 
-        if(text != NULL)
-        {
-            //Copy text for the node
-            iterator->text = (char*)calloc(strlen(text), sizeof(char));
-            strcpy(iterator->text, text);
-        }
+    if(text != NULL)
+    {
+        if(iterator->text != NULL) free(iterator->text); //discard the old text
+
+        //Copy text for the node
+        iterator->text = (char*)calloc(strlen(text)+1, sizeof(char));
+        assert(iterator->text != NULL);
+        strcpy(iterator->text, text);
     }
 }
 
@@ -492,71 +1046,579 @@ alphabetical_tree_node_t *find_token_in_tree(alphabetical_tree_header_t *h, char
 }
 
 /**
- * @brief Run the command function.
- * @param h         Pointer to the header of the alphabetical tree which has the command's token.
- * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ * @brief Visit a node and all nodes below it, building their tokens.
+ * @param node   Pointer to the node.
+ * @param token  Buffer with the token of the node (with room for MAX_TOKEN_LEN chars).
+ * @param len    Length of the token of the node.
+ * @param visit  Function called with the token and the node of each visited node.
+ * @param data   Pointer given to the visit function.
  */
-void run_command(alphabetical_tree_header_t *h, cmd_line_t *cmd_line)
+void walk_subtree_tokens(alphabetical_tree_node_t *node, char *token, size_t len,
+                         void (*visit)(char*, alphabetical_tree_node_t*, void*), void *data)
 {
-    assert(h != NULL);
-    assert(cmd_line != NULL);
+    if(node == NULL || len >= MAX_TOKEN_LEN - 1) return;
 
-    if(!alphabetical_string(cmd_line->command))
+    visit(token, node, data);
+
+    for(int i = 0; i < ALPHABETICAL_TREE_ENTRIES; i++) //alphabetical order
     {
-        printf("ERROR: Commands do not have non-alphabetic characters\n");
-        return;
+        token[len] = 'a' + i;
+        token[len+1] = '\0';
+        walk_subtree_tokens(node->next[i], token, len+1, visit, data);
     }
 
-    alphabetical_tree_node_t *node = find_token_in_tree(h, cmd_line->command);
-
-    if(node != NULL) node->cmd_callback(cmd_line);
-    else printf("command not found\n");
+    token[len] = '\0';
 }
 
-// ================================================
-// =============== COMMAND FEATURES ===============
-// ================================================
-
-alphabetical_tree_header_t *dictionary = NULL; //command dictionary
-alphabetical_tree_header_t *variables = NULL; //variables
-
 /**
- * @brief Treatment function of the PWD command.
- * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ * @brief Visit the nodes of all tokens that begin with a prefix (prefix query).
+ *        The tree is walked down to the prefix node, so only the nodes below it are visited.
+ * @param h       Pointer to the header of the tree.
+ * @param prefix  Lowercase prefix (it can be empty).
+ * @param visit   Function called with the token and the node of each visited node.
+ * @param data    Pointer given to the visit function.
  */
-void pwd_command(cmd_line_t *cmd_line)
+void walk_tokens_with_prefix(alphabetical_tree_header_t *h, char *prefix,
+                             void (*visit)(char*, alphabetical_tree_node_t*, void*), void *data)
 {
-    if(cmd_line->nargs != 0)
+    assert(h != NULL);
+    assert(prefix != NULL);
+
+    char token[MAX_TOKEN_LEN];
+    size_t len = strlen(prefix);
+
+    if(len >= MAX_TOKEN_LEN - 1) return;
+    strcpy(token, prefix);
+
+    if(len > 0)
     {
-        printf("ERROR: The 'pwd' command has no arguments\n");
-        print_cmd_line(cmd_line);
+        walk_subtree_tokens(find_token_in_tree(h, prefix), token, len, visit, data);
+        return;
     }
-    else
-    {
-        char wd_name[MAX_TOKEN_LEN];
-        syscall(SYS_getcwd, wd_name, MAX_TOKEN_LEN);
 
-        printf("%s\n", wd_name); //linux syscall 'getcwd' to get the current working dir name
+    for(int i = 0; i < ALPHABETICAL_TREE_ENTRIES; i++)
+    {
+        token[0] = 'a' + i;
+        token[1] = '\0';
+        walk_subtree_tokens(h->entries[i], token, 1, visit, data);
     }
 }
 
+int expand_cmd_line(cmd_line_t *cmd_line); //defined in the command features
+void call_command(void (*callback)(cmd_line_t*), cmd_line_t *cmd_line); //defined in the command features
+void skip_block(cmd_line_t *header); //defined in the control flow features
+
 /**
- * @brief Treatment function of the CD command.
- * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ * @brief Check if a command reads its typed tokens instead of the expanded arguments: the block headers and 'let'
+ *        (compiled from their tokens) and 'watch' (which expands the watched command on each tick).
+ * @return 1 (true) if the command line must not be expanded before the command. Otherwise, returns 0 (false).
  */
-void cd_command(cmd_line_t *cmd_line)
+int unexpanded_command(char *command)
 {
-    if(cmd_line->nargs != 1)
-    {
-        printf("ERROR: The 'cd' command has 1 argument\n");
-        print_cmd_line(cmd_line);
+    return block_keyword(command) || !strcmp(command, "let") || !strcmp(command, "watch");
+}
+
+/**
+ * @brief Run the command function.
+ * @param h         Pointer to the header of the alphabetical tree which has the command's token.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void run_command(alphabetical_tree_header_t *h, cmd_line_t *cmd_line)
+{
+    assert(h != NULL);
+    assert(cmd_line != NULL);
+
+    if(!alphabetical_string(cmd_line->command))
+    {
+        command_error("ERROR: Commands do not have non-alphabetic characters\n");
+        last_status = 127;
+        return;
+    }
+
+    alphabetical_tree_node_t *node = find_token_in_tree(h, cmd_line->command);
+
+    if(node == NULL || node->cmd_callback == NULL)
+    {
+        command_error("command not found\n");
+        last_status = 127; //the status of the shells for unknown commands
+        return;
+    }
+
+    //block headers, 'let' and 'watch' read their typed tokens, the other commands get the expanded args
+    if(unexpanded_command(cmd_line->command) || expand_cmd_line(cmd_line))
+        call_command(node->cmd_callback, cmd_line);
+}
+
+/**
+ * @brief Check if a command of a list must run, after the exit status of the previous command.
+ * @param op  Operator between the previous command and the command (LIST_END for the first command).
+ * @return 1 (true) if the command must run. Otherwise, returns 0 (false).
+ */
+int list_command_runs(int op)
+{
+    if(op == LIST_AND) return last_status == 0;
+    if(op == LIST_OR) return last_status != 0;
+    return 1;
+}
+
+/**
+ * @brief Run the commands of a list in order. A command after '&&' is skipped if the last status is a failure
+ *        and a command after '||' is skipped if it is a success ('a && b || c' runs 'c' if 'a' or 'b' fails).
+ * @param h     Pointer to the header of the alphabetical tree which has the commands' tokens.
+ * @param list  Pointer to the cmd_list_t struct buffer with the parsed commands.
+ */
+void run_cmd_list(alphabetical_tree_header_t *h, cmd_list_t *list)
+{
+    assert(list != NULL);
+
+    for(size_t i = 0; i < list->n_cmds; i++)
+    {
+        if(i > 0 && !list_command_runs(list->cmds[i-1]->next_op))
+        {
+            if(block_keyword(list->cmds[i]->command)) skip_block(list->cmds[i]); //its body lines are read anyway
+            continue;
+        }
+
+        run_command(h, list->cmds[i]);
+    }
+}
+
+/**
+ * @brief Make room for one more element in a growable array.
+ * @param array      Pointer to the array pointer.
+ * @param cap        Pointer to the capacity of the array (in elements).
+ * @param count      Number of elements in the array.
+ * @param elem_size  Size of each element.
+ */
+void grow_array(void **array, size_t *cap, size_t count, size_t elem_size)
+{
+    if(count < *cap) return;
+
+    *cap = *cap == 0 ? 8 : *cap * 2;
+    *array = realloc(*array, *cap * elem_size);
+    assert(*array != NULL);
+}
+
+// ================================================
+// =============== COMMAND FEATURES ===============
+// ================================================
+
+alphabetical_tree_header_t *dictionary = NULL; //command dictionary
+alphabetical_tree_header_t *variables = NULL; //variables
+unsigned long variables_generation = 1; //incremented each time a variable changes
+
+char **shell_envp = NULL; //NULL-terminated "NAME=value" array given to the executed programs
+size_t n_envp = 0, cap_envp = 0; //number of entries and capacity of 'shell_envp'
+
+/**
+ * @brief Append an entry to the envp array given to the executed programs.
+ * @param entry  Heap "NAME=value" string (it will belong to the array).
+ * @return Index of the entry.
+ */
+size_t append_env_entry(char *entry)
+{
+    if(n_envp + 1 >= cap_envp) //keep room for the NULL terminator
+    {
+        cap_envp = cap_envp == 0 ? 64 : cap_envp * 2;
+        shell_envp = (char**)realloc(shell_envp, cap_envp * sizeof(char*));
+        assert(shell_envp != NULL);
+    }
+
+    shell_envp[n_envp] = entry;
+    shell_envp[n_envp+1] = NULL;
+
+    return n_envp++;
+}
+
+#define NUMBER_TEXT_LEN 32 //size of the text buffer of a number variable (enough for any long long or %.15g double)
+
+/**
+ * @brief Parse a number: an integer (if it fits in 64 bits) or a float.
+ * @param text   Text of the number (without spaces).
+ * @param value  Pointer to where the number will be stored.
+ * @return 1 (true) if the whole text is a number. Otherwise, returns 0 (false).
+ */
+int parse_number(char *text, value_t *value)
+{
+    assert(text != NULL);
+    assert(value != NULL);
+
+    //names, 'inf' and 'nan' are not numbers
+    char *digits = text[0] == '-' || text[0] == '+' ? &text[1] : text;
+    if(!isdigit((unsigned char)digits[0]) && !(digits[0] == '.' && isdigit((unsigned char)digits[1]))) return 0;
+
+    char *end = NULL;
+    errno = 0;
+    long long integer = strtoll(text, &end, 10);
+
+    if(*end == '\0' && errno == 0)
+    {
+        value->type = VALUE_INT;
+        value->integer = integer;
+        return 1;
+    }
+
+    errno = 0;
+    double real = strtod(text, &end);
+
+    if(*end != '\0' || errno != 0 || strpbrk(text, "xXpP") != NULL) return 0; //no hexadecimal floats
+
+    value->type = VALUE_FLOAT;
+    value->real = real;
+    return 1;
+}
+
+/**
+ * @brief Write a number in a text buffer (with room for NUMBER_TEXT_LEN chars).
+ */
+void format_number(value_t *value, char *buffer)
+{
+    if(value->type == VALUE_INT)
+        snprintf(buffer, NUMBER_TEXT_LEN, "%lld", value->integer);
+    else
+        snprintf(buffer, NUMBER_TEXT_LEN, "%.15g", value->real);
+}
+
+/**
+ * @brief Get the text of a variable. A number is written in the text buffer of the variable
+ *        only here, when its text is used after a change (arithmetic does not make texts).
+ * @param slot  Pointer to the variable's node.
+ * @return The text, or NULL if the variable has no content.
+ */
+char *variable_text(alphabetical_tree_node_t *slot)
+{
+    assert(slot != NULL);
+
+    if(slot->text_stale)
+    {
+        format_number(&slot->value, slot->text);
+        slot->text_stale = 0;
+    }
+
+    return slot->text;
+}
+
+/**
+ * @brief Rebuild the envp entry of an exported variable with its current content.
+ *        Only this entry changes, so the envp array is always ready for 'execve'.
+ * @param slot  Pointer to the variable's node.
+ */
+void update_env_entry(alphabetical_tree_node_t *slot)
+{
+    assert(slot != NULL);
+
+    if(slot->env_name == NULL || slot->text == NULL) return; //not exported or without content
+
+    variable_text(slot); //numbers are written before they go to the environment
+
+    char *entry = (char*)malloc(strlen(slot->env_name) + strlen(slot->text) + 2);
+    assert(entry != NULL);
+    sprintf(entry, "%s=%s", slot->env_name, slot->text);
+
+    if(slot->env_index == -1) //first content since the export
+    {
+        slot->env_index = append_env_entry(entry);
+    }
+    else
+    {
+        free(shell_envp[slot->env_index]);
+        shell_envp[slot->env_index] = entry;
+    }
+}
+
+alphabetical_tree_node_t *find_variable(char *name); //defined in the state image features
+alphabetical_tree_node_t *insert_variable_node(char *name); //defined in the state image features
+
+/**
+ * @brief Get the node of a variable in the variables tree, creating it (without content) if it does not exist.
+ *        Nodes are never removed from the tree, so the returned pointer can be kept as a slot for the variable.
+ * @param name  Lowercase name of the variable.
+ * @return Pointer to the variable's node.
+ */
+alphabetical_tree_node_t *variable_slot(char *name)
+{
+    assert(variables != NULL);
+    assert(name != NULL);
+
+    alphabetical_tree_node_t *slot = find_variable(name);
+
+    if(slot == NULL) slot = insert_variable_node(name);
+
+    assert(slot != NULL);
+    return slot;
+}
+
+void release_variable_text(char *text); //defined in the state image features
+
+/**
+ * @brief Set the content of a variable, taking a heap buffer as its content (no copies).
+ * @param slot    Pointer to the variable's node.
+ * @param buffer  Heap text buffer that will belong to the variable.
+ */
+void assign_variable_buffer(alphabetical_tree_node_t *slot, char *buffer)
+{
+    assert(slot != NULL);
+    assert(buffer != NULL);
+
+    if(slot->text != NULL) release_variable_text(slot->text); //discard the old content
+    slot->text = buffer;
+    slot->value.type = VALUE_TEXT;
+    slot->text_stale = 0;
+
+    variables_generation++; //expanded args pointing to the old content are stale now
+
+    if(slot->env_name != NULL) update_env_entry(slot); //exported variable
+}
+
+/**
+ * @brief Set the content of a variable.
+ * @param slot  Pointer to the variable's node.
+ * @param text  Text that will be copied to the variable.
+ */
+void assign_variable(alphabetical_tree_node_t *slot, char *text)
+{
+    assert(text != NULL);
+
+    char *new_text = (char*)calloc(strlen(text)+1, sizeof(char));
+    assert(new_text != NULL);
+    strcpy(new_text, text); //copy before freeing, because 'text' can be the old content itself
+
+    assign_variable_buffer(slot, new_text);
+}
+
+/**
+ * @brief Set a number as the content of a variable. The number is kept in binary: its text is written
+ *        only when it is used (so a counter can change many times without making texts).
+ * @param slot   Pointer to the variable's node.
+ * @param value  Pointer to the number (VALUE_INT or VALUE_FLOAT).
+ */
+void assign_variable_number(alphabetical_tree_node_t *slot, value_t *value)
+{
+    assert(slot != NULL);
+    assert(value != NULL && value->type != VALUE_TEXT);
+
+    if(slot->value.type == VALUE_TEXT) //the variable gets a text buffer for its numbers
+    {
+        char *buffer = (char*)malloc(NUMBER_TEXT_LEN);
+        assert(buffer != NULL);
+
+        if(slot->text != NULL) release_variable_text(slot->text);
+        slot->text = buffer;
+    }
+
+    slot->value = *value;
+    slot->text_stale = 1;
+
+    variables_generation++; //expanded args must read the new number
+
+    if(slot->env_name != NULL) update_env_entry(slot); //exported variable
+}
+
+/**
+ * @brief Import the environment of the shell process.
+ *        Entries with alphabetical names become exported variables with lowercase names (PATH is $path).
+ *        The other entries are only passed to the executed programs.
+ * @param envp  NULL-terminated "NAME=value" array.
+ */
+void import_environment(char **envp)
+{
+    assert(envp != NULL);
+
+    for(size_t i = 0; envp[i] != NULL; i++)
+    {
+        char *equal = strchr(envp[i], '=');
+        char name[MAX_TOKEN_LEN];
+        size_t name_len = equal == NULL ? 0 : equal - envp[i];
+
+        int importable = name_len > 0 && name_len < MAX_TOKEN_LEN;
+
+        for(size_t j = 0; importable && j < name_len; j++)
+        {
+            name[j] = tolower(envp[i][j]);
+            importable = name[j] >= 'a' && name[j] <= 'z';
+        }
+
+        alphabetical_tree_node_t *slot = NULL;
+
+        if(importable)
+        {
+            name[name_len] = '\0';
+            slot = variable_slot(name);
+        }
+
+        if(slot == NULL || slot->env_name != NULL) //not a shell variable (or a name already imported with other case)
+        {
+            append_env_entry(strdup(envp[i]));
+            continue;
+        }
+
+        slot->env_name = strndup(envp[i], name_len);
+        assign_variable(slot, equal + 1); //adds the envp entry
+    }
+}
+
+char *capture_command_output(char *text); //defined after the EXEC command
+
+int expand_glob_token(cmd_line_t *cmd_line, size_t tokeni); //defined in the glob features
+
+/**
+ * @brief Add an argument to the expanded args of the cmd_line.
+ */
+void push_cmd_line_arg(cmd_line_t *cmd_line, char *arg)
+{
+    grow_array((void**)&cmd_line->args, &cmd_line->cap_args, cmd_line->nargs, sizeof(char*));
+    cmd_line->args[cmd_line->nargs++] = arg;
+}
+
+/**
+ * @brief Make the args of the cmd_line point to the expansion of its tokens:
+ *        '$varname' tokens become the contents of the variables, '$(command)' tokens become the outputs
+ *        of the commands, glob patterns become the matching paths and '$$text' tokens become '$text'.
+ *        The variable nodes are looked up and the patterns are compiled only once per cmd_line,
+ *        and the expansion is skipped if no variable has changed since the last one (and there are no
+ *        substitutions or patterns, which are expanded again on each run).
+ * @param cmd_line  Pointer to the working cmd_line_t struct buffer.
+ * @return 1 (true) if the args have been expanded. Otherwise (a variable is not defined), returns 0 (false).
+ */
+int expand_cmd_line(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+    assert(variables != NULL);
+
+    //the views are still valid
+    if(cmd_line->generation == variables_generation && cmd_line->n_dynamic == 0) return 1;
+
+    //first pass: glob matches (the storage can move while it grows, so the args point to it later)
+    size_t *n_matches = NULL;
+
+    if(cmd_line->n_dynamic > 0)
+    {
+        cmd_line->storage.len = 0;
+        cmd_line->storage.n_offsets = 0;
+
+        n_matches = (size_t*)calloc(cmd_line->n_tokens, sizeof(size_t));
+        assert(n_matches != NULL);
+
+        for(size_t i = 0; i < cmd_line->n_tokens; i++)
+        {
+            if(cmd_line->tokens[i][0] != '$' && dynamic_token(cmd_line->tokens[i]))
+                n_matches[i] = expand_glob_token(cmd_line, i);
+        }
+    }
+
+    //second pass: args
+    size_t match = 0; //next glob match in the storage
+    cmd_line->nargs = 0;
+
+    for(size_t i = 0; i < cmd_line->n_tokens; i++)
+    {
+        char *token = cmd_line->tokens[i];
+
+        if(n_matches != NULL && n_matches[i] > 0) //glob pattern with matches
+        {
+            for(size_t j = 0; j < n_matches[i]; j++, match++)
+                push_cmd_line_arg(cmd_line, &cmd_line->storage.data[cmd_line->storage.offsets[match]]);
+        }
+        else if(token[0] != '$' || token[1] == '\0') //plain text (or pattern without matches)
+        {
+            push_cmd_line_arg(cmd_line, token);
+        }
+        else if(token[1] == '(') //command substitution
+        {
+            size_t token_len = strlen(token);
+
+            if(token[token_len-1] != ')')
+            {
+                command_error("ERROR: Missing \')\' in \'%s\'\n", token);
+                free(n_matches);
+                return 0;
+            }
+
+            token[token_len-1] = '\0'; //cut ')' while the command runs
+            char *output = capture_command_output(&token[2]);
+            token[token_len-1] = ')';
+
+            if(output == NULL)
+            {
+                free(n_matches);
+                return 0;
+            }
+
+            if(cmd_line->outputs[i] != NULL) free(cmd_line->outputs[i]); //output of the last run
+            cmd_line->outputs[i] = output;
+            push_cmd_line_arg(cmd_line, output);
+        }
+        else if(token[1] == '$') //arg begins with '$' but is not a variable name
+        {
+            push_cmd_line_arg(cmd_line, &token[1]);
+        }
+        else //arg is a variable name
+        {
+            if(cmd_line->slots[i] == NULL) //not resolved yet
+            {
+                if(!alphabetical_string(&token[1]))
+                {
+                    command_error("ERROR: Variable's names have only alphabetical chars\n");
+                    free(n_matches);
+                    return 0;
+                }
+
+                cmd_line->slots[i] = find_variable(&token[1]);
+            }
+
+            if(cmd_line->slots[i] == NULL || cmd_line->slots[i]->text == NULL)
+            {
+                command_error("ERROR: Variable \'%s\' not found\n", &token[1]);
+                free(n_matches);
+                return 0;
+            }
+
+            push_cmd_line_arg(cmd_line, variable_text(cmd_line->slots[i]));
+        }
+    }
+
+    free(n_matches);
+    cmd_line->generation = variables_generation;
+    return 1;
+}
+
+/**
+ * @brief Treatment function of the PWD command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void pwd_command(cmd_line_t *cmd_line)
+{
+    if(cmd_line->nargs != 0)
+    {
+        command_error("ERROR: The 'pwd' command has no arguments\n");
+        print_cmd_line(cmd_line);
+    }
+    else
+    {
+        char wd_name[MAX_TOKEN_LEN];
+        syscall(SYS_getcwd, wd_name, MAX_TOKEN_LEN);
+
+        printf("%s\n", wd_name); //linux syscall 'getcwd' to get the current working dir name
+    }
+}
+
+/**
+ * @brief Treatment function of the CD command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void cd_command(cmd_line_t *cmd_line)
+{
+    if(cmd_line->nargs != 1)
+    {
+        command_error("ERROR: The 'cd' command has 1 argument\n");
+        print_cmd_line(cmd_line);
     }
     else
     {
         int retval = syscall(SYS_chdir, cmd_line->args[0]); //linux syscall 'chdir' to change the current working dir name
 
         if(retval == -1) //error flag
-            printf("ERROR: Cannot change the working directory path for that\n");
+            command_error("ERROR: Cannot change the working directory path for that\n");
     }
 }
 
@@ -566,14 +1628,21 @@ void cd_command(cmd_line_t *cmd_line)
  */
 void exit_command(cmd_line_t *cmd_line)
 {
-    if(cmd_line->nargs != 0)
+    long status = EXIT_SUCCESS;
+    char *end = NULL;
+
+    if(cmd_line->nargs == 1)
+        status = strtol(cmd_line->args[0], &end, 10);
+
+    if(cmd_line->nargs > 1 || (end != NULL && (*end != '\0' || end == cmd_line->args[0] || status < 0 || status > 255)))
     {
-        printf("ERROR: The 'exit' command has no arguments\n");
+        command_error("ERROR: The 'exit' command has only an optional status (0 to 255)\n");
         print_cmd_line(cmd_line);
     }
     else
     {
-        syscall(SYS_exit, EXIT_SUCCESS); //linux syscall 'exit' to close the program
+        fflush(stdout);
+        syscall(SYS_exit, status); //linux syscall 'exit' to close the program
     }
 }
 
@@ -591,10 +1660,59 @@ typedef struct linux_dirent {
     char           d_name[];
 }linux_dirent_t;
 
-#define DENTS_BUFFER_SIZE 1024*1024*5
-
 /**
- * @brief Print name and type of each entrie in the dirents buffer.
+ * @brief Linux's dirent64 (64 bits directory entrie) struct, used by the 'getdents64' syscall. Do not change it.
+ * @param d_ino     Inode number (64 bits)
+ * @param d_off     Offset to next linux_dirent64 (64 bits)
+ * @param d_reclen  Length of this linux_dirent64 (16 bits)
+ * @param d_type    File type (8 bits)
+ * @param d_name    Filename (null-terminated)
+ */
+typedef struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long          d_off;
+    unsigned short     d_reclen;
+    unsigned char      d_type;
+    char               d_name[];
+}linux_dirent64_t;
+
+#define DENTS_BUFFER_SIZE 1024*1024*5
+
+/**
+ * @brief Print name and type of a directory entrie.
+ * @param out   Output stream.
+ * @param name  Name of the entrie.
+ * @param type  Type of the entrie (DT_* flag).
+ */
+void print_entry(FILE *out, char *name, unsigned char type)
+{
+    switch (type) //print small entrie's type
+    {
+        case DT_DIR: fprintf(out, "[DIR]"); break; //directory entrie
+        case DT_REG: fprintf(out, "[FILE]"); break; //file entrie
+        case DT_LNK: fprintf(out, "[LINK]"); break; //link entrie
+        case DT_SOCK:
+        case DT_CHR:
+        case DT_BLK:
+        case DT_FIFO: fprintf(out, "[SYS]"); break; //system entrie (devices, sockets and pipes)
+        default: fprintf(out, "[UNK]"); //unknow entrie type
+    }
+
+    fprintf(out, "\t%s\t\t", name); //print entrie's name
+
+    switch (type) //print system entrie's type description
+    {
+        case DT_SOCK: fprintf(out, "(network socket)"); break;
+        case DT_CHR: fprintf(out, "(char device)"); break;
+        case DT_BLK: fprintf(out, "(block device)"); break;
+        case DT_FIFO: fprintf(out, "(pipe)"); break;
+    }
+
+    fprintf(out, "\n"); //break line
+}
+
+/**
+ * @brief Print name and type of each entrie in the dirents buffer.
  *        This function is used by the LS command.
  *
  * @param buffer        Pointer to the dirents buffer
@@ -614,320 +1732,6022 @@ void print_entries(void *buffer, size_t n_entries)
         char entrie_type = *(char*)((unsigned long)entrie + entrie->d_reclen - 1);
 
         if(strcmp(entrie->d_name,"..") && strcmp(entrie->d_name,".")) //ignore '..' and '.' dir entries
+            print_entry(stdout, entrie->d_name, entrie_type);
+    }
+}
+
+extern int ls_cache_enabled; //defined in the directory cache features
+int print_cached_listing(char *path); //defined in the directory cache features
+
+/**
+ * @brief Treatment function of the LS command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void ls_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    char cwd[PATH_MAX]; //buffer to working dir name
+    char *dir_name = cwd; //path of the listed directory
+
+    // STEP 1 - GET THE PATH OF THE DIRECTORY THAT WILL BE LOAD
+
+    if(cmd_line->nargs > 1)
+    {
+        command_error("ERROR: The ls command has 0 or 1 arguments\n");
+        print_cmd_line(cmd_line);
+        return;
+    }
+    else if(cmd_line->nargs == 1)
+        dir_name = cmd_line->args[0]; //used in place: expanded args ($varname, $(command)) have any length
+    else if(getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        command_error("ERROR: Cannot get the working directory (%s)\n", strerror(errno));
+        return;
+    }
+
+    // STEP 2 - WITH THE LS CACHE, PRINT THE LISTING FROM MEMORY
+
+    if(ls_cache_enabled)
+    {
+        if(!print_cached_listing(dir_name))
+            command_error("ERROR: Cannot read entries of that directory\n");
+        return;
+    }
+
+    // STEP 3 - LOAD THE DIRECTORY AS A DESCRIPTOR
+
+    int fd = open(dir_name, O_RDONLY | O_DIRECTORY); //open the working dir as a file descriptor
+
+    if(fd == -1) //file descriptor equal to -1 is an error flag
+    {
+        command_error("ERROR: Cannot load that directory descriptor\n");
+        return;
+    }
+
+    // STEP 4 - GET DIRECTORY ENTRIES FROM THE DESCRIPTOR AND PRINT ITS INFORMATIONS
+
+    void *buffer = malloc(DENTS_BUFFER_SIZE); //buffer to dir entries
+
+    long n_read = syscall(SYS_getdents, fd, buffer, DENTS_BUFFER_SIZE); //getdents syscall to get dir entries
+
+    //the 'getdents' syscall must be repeated as long as there are unread entries in the descriptor.
+    while(n_read != 0) //do it while the 'getdents' syscall gets most than zero entries
+    {
+        if(n_read == -1) //n_read equal to -1 is an error flag
+        {
+            command_error("ERROR: Cannot read entries of that directory\n");
+            break;
+        }
+
+        print_entries(buffer, n_read); //print entries informations
+
+        //repeat 'getdents' syscall to get remaining dir entries
+        n_read = syscall(SYS_getdents, fd, buffer, DENTS_BUFFER_SIZE);
+    }
+
+    free(buffer);
+    close(fd);
+}
+
+#define CAT_CHUNK_SIZE (1024*1024) //Maximum bytes moved by each 'sendfile' or 'splice' syscall
+#define REDIRECT_BUFFER_SIZE (64*1024) //Buffer size of the streams of redirected builtins
+
+/**
+ * @brief Move the contents of a descriptor to the shell's output (stdout) until its end.
+ * @param in_fd   Input descriptor.
+ * @return 1 (true) on success. Otherwise, returns 0 (false).
+ */
+int copy_to_output(int in_fd)
+{
+    fflush(stdout); //keep the order of the output
+    int out_fd = fileno(stdout); //-1 for memory streams ('$(command)' substitutions)
+    ssize_t n;
+
+    if(out_fd != -1)
+    {
+        //regular files are sent to any descriptor inside the kernel
+        while((n = sendfile(out_fd, in_fd, NULL, CAT_CHUNK_SIZE)) > 0);
+        if(n == 0) return 1;
+        if(errno != EINVAL && errno != ENOSYS) return 0;
+
+        //a pipe on either side can be spliced
+        while((n = splice(in_fd, NULL, out_fd, NULL, CAT_CHUNK_SIZE, SPLICE_F_MOVE)) > 0);
+        if(n == 0) return 1;
+        if(errno != EINVAL) return 0;
+    }
+
+    //plain copy (e.g. terminal to terminal, files opened for appending or memory streams)
+    char *buffer = (char*)malloc(CAT_CHUNK_SIZE);
+    assert(buffer != NULL);
+
+    while((n = read(in_fd, buffer, CAT_CHUNK_SIZE)) > 0)
+        fwrite(buffer, 1, n, stdout);
+
+    free(buffer);
+    return n == 0;
+}
+
+/**
+ * @brief Treatment function of the CAT command.
+ *        The files are moved to the output inside the kernel: 'sendfile' from regular files and 'splice'
+ *        from or to pipes, so large files are not copied to user space (a plain copy is the fallback).
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void cat_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(cmd_line->nargs == 0) //no files: copy the input
+    {
+        if(!copy_to_output(fileno(stdin)))
+            command_error("ERROR: Cannot read the input\n");
+        return;
+    }
+
+    for(size_t i = 0; i < cmd_line->nargs; i++)
+    {
+        int fd = open(cmd_line->args[i], O_RDONLY | O_CLOEXEC);
+
+        if(fd == -1)
+        {
+            command_error("ERROR: Cannot open \'%s\'\n", cmd_line->args[i]);
+            continue;
+        }
+
+        if(!copy_to_output(fd))
+            command_error("ERROR: Cannot read \'%s\'\n", cmd_line->args[i]);
+
+        close(fd);
+    }
+}
+
+/**
+ * @brief Get the path of a redirection target ($varname or text).
+ * @return The path, or NULL if it is missing (the error is printed).
+ */
+char *redirection_path(redirect_t *redirect)
+{
+    char *target = redirect->target;
+
+    if(target == NULL)
+    {
+        command_error("ERROR: Missing file name after the redirection\n");
+        return NULL;
+    }
+
+    if(target[0] != '$') return target;
+    if(target[1] == '$') return &target[1]; //'$$text' means the '$text' path
+
+    alphabetical_tree_node_t *node = alphabetical_string(&target[1]) ? find_variable(&target[1]) : NULL;
+
+    if(node == NULL || node->text == NULL)
+    {
+        command_error("ERROR: Variable \'%s\' not found\n", &target[1]);
+        return NULL;
+    }
+
+    return variable_text(node);
+}
+
+/**
+ * @brief Open the target files of the redirections of a cmd_line.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer.
+ * @param fds       Array where the descriptor of each redirection will be stored (-1 for '2>&1').
+ * @return 1 (true) on success. Otherwise (the opened files are closed), returns 0 (false).
+ */
+int open_redirections(cmd_line_t *cmd_line, int *fds)
+{
+    for(size_t i = 0; i < cmd_line->n_redirects; i++)
+    {
+        redirect_t *redirect = &cmd_line->redirects[i];
+        fds[i] = -1;
+
+        if(redirect->fd == STDERR_FILENO && redirect->target != NULL && !strcmp(redirect->target, "&1")) continue;
+
+        char *path = redirection_path(redirect);
+        if(path != NULL) fds[i] = open(path, redirect->flags | O_CLOEXEC, 0644);
+
+        if(fds[i] == -1)
+        {
+            if(path != NULL) command_error("ERROR: Cannot open \'%s\'\n", path);
+
+            for(size_t j = 0; j < i; j++)
+                if(fds[j] != -1) close(fds[j]);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Point the standard descriptors of a child process to the redirections of its cmd_line.
+ * @return 1 (true) on success. Otherwise, returns 0 (false).
+ */
+int redirect_child(cmd_line_t *cmd_line)
+{
+    if(cmd_line->n_redirects == 0) return 1;
+
+    int fds[cmd_line->n_redirects];
+    if(!open_redirections(cmd_line, fds)) return 0;
+
+    for(size_t i = 0; i < cmd_line->n_redirects; i++)
+    {
+        if(fds[i] == -1) //'2>&1'
+            dup2(STDOUT_FILENO, STDERR_FILENO);
+        else
+        {
+            dup2(fds[i], cmd_line->redirects[i].fd);
+            close(fds[i]);
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Linux's sched_attr struct, used by the 'sched_setattr' syscall. Do not change it.
+ */
+typedef struct
+{
+    unsigned int       size;
+    unsigned int       sched_policy;
+    unsigned long long sched_flags;
+    int                sched_nice;
+    unsigned int       sched_priority;
+    unsigned long long sched_runtime;
+    unsigned long long sched_deadline;
+    unsigned long long sched_period;
+} linux_sched_attr_t;
+
+#define CGROUP_ROOT "/sys/fs/cgroup" //Mount point of the cgroup v2 hierarchy
+#define CPU_MAX_PERIOD "100000" //Default period (us) of the '--cpumax' quota
+
+/**
+ * @brief Placement and scheduling options of the EXEC command.
+ * @param first     Index of the program path in the args (after the options).
+ * @param has_cpus  1 (true) if '--cpus' has been given. Otherwise, 0 (false).
+ * @param cpus      CPUs allowed to the program.
+ * @param has_nice  1 (true) if '--nice' has been given. Otherwise, 0 (false).
+ * @param nice      Nice value of the program (-20 to 19).
+ * @param policy    Scheduling policy of the program (SCHED_OTHER, SCHED_BATCH or SCHED_IDLE), or -1 to keep the shell's.
+ * @param cpu_max   Contents written to the 'cpu.max' file of the cgroup ("" without '--cpumax').
+ * @param cgroup    Path of the cgroup created for the program ("" without '--cpumax').
+ */
+typedef struct
+{
+    size_t first;
+    int has_cpus;
+    cpu_set_t cpus;
+    int has_nice;
+    int nice;
+    int policy;
+    char cpu_max[64];
+    char cgroup[PATH_MAX];
+} exec_options_t;
+
+/**
+ * @brief Read a CPU list ('0-3,6,8-11') into a CPU set.
+ * @param text  CPU list.
+ * @param cpus  Pointer to the CPU set.
+ * @return 1 (true) on success. Otherwise (syntax error), returns 0 (false).
+ */
+int parse_cpu_list(char *text, cpu_set_t *cpus)
+{
+    CPU_ZERO(cpus);
+
+    while(1)
+    {
+        char *end;
+
+        if(!isdigit(*text)) return 0;
+        unsigned long low = strtoul(text, &end, 10), high = low;
+
+        if(*end == '-') //range
+        {
+            text = end+1;
+            if(!isdigit(*text)) return 0;
+            high = strtoul(text, &end, 10);
+        }
+
+        if(low > high || high >= CPU_SETSIZE) return 0;
+
+        for(unsigned long cpu = low; cpu <= high; cpu++)
+            CPU_SET(cpu, cpus);
+
+        if(*end == '\0') return 1;
+        if(*end != ',') return 0;
+        text = end+1;
+    }
+}
+
+/**
+ * @brief Print a CPU set as a CPU list ('0-3,6').
+ * @param cpus  Pointer to the CPU set.
+ */
+void print_cpu_list(cpu_set_t *cpus)
+{
+    int first = 1;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(!CPU_ISSET(cpu, cpus)) continue;
+
+        int last = cpu;
+        while(last+1 < CPU_SETSIZE && CPU_ISSET(last+1, cpus)) last++;
+
+        printf(first ? "%d" : ",%d", cpu);
+        if(last > cpu) printf("-%d", last);
+
+        first = 0;
+        cpu = last;
+    }
+
+    printf("\n");
+}
+
+/**
+ * @brief Read the options before the program path of the EXEC command
+ *        ('--cpus LIST', '--nice N', '--sched batch|idle|other' and '--cpumax QUOTA[/PERIOD]').
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the expanded arguments.
+ * @param options   Pointer to where the options will be stored.
+ * @return 1 (true) on success. Otherwise (the error is printed), returns 0 (false).
+ */
+int parse_exec_options(cmd_line_t *cmd_line, exec_options_t *options)
+{
+    memset(options, 0, sizeof(exec_options_t));
+    options->policy = -1;
+
+    size_t i = 0;
+
+    while(i < cmd_line->nargs && !strncmp(cmd_line->args[i], "--", 2))
+    {
+        char *option = cmd_line->args[i];
+
+        if(!strcmp(option, "--")) //end of the options
+        {
+            i++;
+            break;
+        }
+
+        if(i+1 >= cmd_line->nargs)
+        {
+            command_error("ERROR: Missing value of \'%s\'\n", option);
+            return 0;
+        }
+
+        char *value = cmd_line->args[i+1];
+        char *end = NULL;
+
+        if(!strcmp(option, "--cpus"))
         {
-            switch (entrie_type) //print small entrie's type
+            if(!parse_cpu_list(value, &options->cpus))
             {
-                case DT_DIR: printf("[DIR]"); break; //directory entrie
-                case DT_REG: printf("[FILE]"); break; //file entrie
-                case DT_LNK: printf("[LINK]"); break; //link entrie
-                case DT_SOCK:
-                case DT_CHR:
-                case DT_BLK:
-                case DT_FIFO: printf("[SYS]"); break; //system entrie (devices, sockets and pipes)
-                default: printf("[UNK]"); //unknow entrie type
+                command_error("ERROR: Invalid CPU list \'%s\' (e.g. 0-3,6)\n", value);
+                return 0;
             }
+            options->has_cpus = 1;
+        }
+        else if(!strcmp(option, "--nice"))
+        {
+            options->nice = strtol(value, &end, 10);
 
-            printf("\t%s\t\t",entrie->d_name); //print entrie's name
+            if(*value == '\0' || *end != '\0' || options->nice < -20 || options->nice > 19)
+            {
+                command_error("ERROR: The nice value must be a number from -20 to 19\n");
+                return 0;
+            }
+            options->has_nice = 1;
+        }
+        else if(!strcmp(option, "--sched"))
+        {
+            if(!strcmp(value, "batch")) options->policy = SCHED_BATCH;
+            else if(!strcmp(value, "idle")) options->policy = SCHED_IDLE;
+            else if(!strcmp(value, "other")) options->policy = SCHED_OTHER;
+            else
+            {
+                command_error("ERROR: The scheduling policy must be batch, idle or other\n");
+                return 0;
+            }
+        }
+        else if(!strcmp(option, "--cpumax"))
+        {
+            size_t quota_len = strcspn(value, "/");
+            char *period = value[quota_len] == '/' ? &value[quota_len+1] : CPU_MAX_PERIOD;
+            int valid = quota_len > 0 && *period != '\0' && strspn(period, "0123456789") == strlen(period) &&
+                        (strspn(value, "0123456789") == quota_len || (quota_len == 3 && !strncmp(value, "max", 3)));
 
-            switch (entrie_type) //print system entrie's type description
+            if(!valid || quota_len + strlen(period) + 2 > sizeof(options->cpu_max))
             {
-                case DT_SOCK: printf("(network socket)"); break;
-                case DT_CHR: printf("(char device)"); break;
-                case DT_BLK: printf("(block device)"); break;
-                case DT_FIFO: printf("(pipe)"); break;
+                command_error("ERROR: The cpu.max quota must be QUOTA[/PERIOD] in microseconds (or max)\n");
+                return 0;
             }
+            sprintf(options->cpu_max, "%.*s %s", (int)quota_len, value, period);
+        }
+        else
+        {
+            command_error("ERROR: Unknown exec option \'%s\'\n", option);
+            return 0;
+        }
+
+        i += 2;
+    }
+
+    if(i >= cmd_line->nargs)
+    {
+        command_error("ERROR: The exec command has at least 1 argument\n");
+        return 0;
+    }
+
+    options->first = i;
+    return 1;
+}
+
+/**
+ * @brief Write a text to a (cgroup) file.
+ * @return 1 (true) on success. Otherwise, returns 0 (false).
+ */
+int write_text_file(char *path, char *text)
+{
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if(fd == -1) return 0;
+
+    ssize_t written = write(fd, text, strlen(text));
+    close(fd);
+
+    return written == (ssize_t)strlen(text);
+}
+
+/**
+ * @brief Check that the cpu controller is enabled for the children of a cgroup v2, enabling it if it is not.
+ *        Enabling fails in a non-root cgroup with processes (no internal processes rule) or without
+ *        write access to the cgroup (not delegated).
+ * @param cgroup  Path of the cgroup directory.
+ * @return 1 (true) if its children can have a 'cpu.max' quota. Otherwise, returns 0 (false).
+ */
+int cgroup_delegates_cpu(char *cgroup)
+{
+    char path[PATH_MAX + 32], controllers[256] = "";
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroup);
+
+    FILE *file = fopen(path, "r");
+    if(file == NULL) return 0;
+
+    if(fgets(controllers, sizeof(controllers), file) == NULL) controllers[0] = '\0';
+    fclose(file);
+
+    for(char *name = strtok(controllers, " \n"); name != NULL; name = strtok(NULL, " \n"))
+        if(!strcmp(name, "cpu")) return 1;
+
+    return write_text_file(path, "+cpu");
+}
+
+/**
+ * @brief Move the shell to a cgroup v2.
+ * @return 1 (true) on success. Otherwise, returns 0 (false).
+ */
+int move_shell_to_cgroup(char *cgroup)
+{
+    char path[PATH_MAX + 32], pid[32];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", cgroup);
+    sprintf(pid, "%d", getpid());
+
+    return write_text_file(path, pid);
+}
+
+/**
+ * @brief Find (once) the cgroup v2 where the cgroups of '--cpumax' are created, with the cpu controller enabled:
+ *        the cgroup of the shell if it is the root; else the cgroup of the shell after moving the shell to a leaf
+ *        cgroup below it (a delegated cgroup where the shell is the only process); else the parent cgroup,
+ *        next to the shell (which needs write access, e.g. for root).
+ * @return Path of the cgroup. Otherwise (the error is printed), returns NULL.
+ */
+char *exec_cgroup_parent()
+{
+    static char parent[PATH_MAX] = "";
+
+    if(parent[0] != '\0') return parent;
+
+    //'0::/path' is the cgroup v2 of the shell
+    char line[PATH_MAX] = "";
+    FILE *proc = fopen("/proc/self/cgroup", "r");
+
+    if(proc != NULL)
+    {
+        while(fgets(line, sizeof(line), proc) != NULL && strncmp(line, "0::", 3));
+        fclose(proc);
+    }
+
+    if(strncmp(line, "0::", 3))
+    {
+        command_error("ERROR: The shell is not in a cgroup v2\n");
+        return NULL;
+    }
+
+    line[strcspn(line, "\n")] = '\0';
+    char *self = !strcmp(&line[3], "/") ? "" : &line[3];
+    char self_path[PATH_MAX];
+    int len = snprintf(self_path, sizeof(self_path), CGROUP_ROOT "%s", self);
+
+    if(len < 0 || (size_t)len >= sizeof(self_path))
+    {
+        command_error("ERROR: The cgroup path of the shell is too long\n");
+        return NULL;
+    }
+
+    if(cgroup_delegates_cpu(self_path))
+    {
+        strcpy(parent, self_path);
+        return parent;
+    }
+
+    if(self[0] != '\0')
+    {
+        //no internal processes: the shell leaves its cgroup for a leaf, moving back if the cgroup still has others
+        char leaf[PATH_MAX];
+        len = snprintf(leaf, sizeof(leaf), "%s/small-shell-%d", self_path, getpid());
+
+        if(len >= 0 && (size_t)len < sizeof(leaf) && mkdir(leaf, 0755) == 0)
+        {
+            if(move_shell_to_cgroup(leaf) && cgroup_delegates_cpu(self_path))
+            {
+                strcpy(parent, self_path);
+                return parent;
+            }
+
+            move_shell_to_cgroup(self_path);
+            rmdir(leaf);
+        }
+
+        *strrchr(self_path, '/') = '\0';
+
+        if(cgroup_delegates_cpu(self_path))
+        {
+            strcpy(parent, self_path);
+            return parent;
+        }
+    }
+
+    command_error("ERROR: Cannot enable the cpu controller for a cgroup below or next to \'%s\'\n"
+                  "\tRun the shell in a delegated cgroup (e.g. systemd-run --user --scope -p Delegate=yes)\n", self[0] ? self : "/");
+    return NULL;
+}
+
+/**
+ * @brief Create a cgroup v2 for a program launched with '--cpumax', below the cgroup found by 'exec_cgroup_parent'.
+ * @param options   Pointer to the options of the EXEC command.
+ * @return 1 (true) on success or without '--cpumax'. Otherwise (the error is printed), returns 0 (false).
+ */
+int create_exec_cgroup(exec_options_t *options)
+{
+    static unsigned long n_cgroups = 0; //cgroups created by this shell (for unique names)
+
+    if(options->cpu_max[0] == '\0') return 1;
+
+    char *parent = exec_cgroup_parent();
+    if(parent == NULL) return 0;
+
+    int len = snprintf(options->cgroup, sizeof(options->cgroup), "%s/small-shell-%d-%lu", parent, getpid(), n_cgroups++);
+
+    if(len < 0 || (size_t)len >= sizeof(options->cgroup) || mkdir(options->cgroup, 0755) == -1)
+    {
+        command_error("ERROR: Cannot create the cgroup \'%s\'\n", options->cgroup);
+        options->cgroup[0] = '\0';
+        return 0;
+    }
+
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/cpu.max", options->cgroup);
+
+    if(!write_text_file(path, options->cpu_max))
+    {
+        command_error("ERROR: Cannot set the cpu.max quota of the cgroup \'%s\'\n", options->cgroup);
+        rmdir(options->cgroup);
+        options->cgroup[0] = '\0';
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Remove the cgroup of a finished program.
+ */
+void remove_exec_cgroup(exec_options_t *options)
+{
+    if(options->cgroup[0] != '\0') rmdir(options->cgroup); //the cgroup is empty after 'waitpid'
+}
+
+/**
+ * @brief Apply the placement and scheduling options to the current (child) process, before 'execve'.
+ *        The policy and the nice value are set together by a single 'sched_setattr' syscall.
+ * @return 1 (true) on success. Otherwise (the error is printed), returns 0 (false).
+ */
+int apply_exec_options(exec_options_t *options)
+{
+    if(options->cgroup[0] != '\0') //join the cgroup
+    {
+        char path[PATH_MAX + 16], pid[32];
+        snprintf(path, sizeof(path), "%s/cgroup.procs", options->cgroup);
+        sprintf(pid, "%d", getpid());
+
+        if(!write_text_file(path, pid))
+        {
+            command_error("ERROR: Cannot move the program to the cgroup \'%s\'\n", options->cgroup);
+            return 0;
+        }
+    }
+
+    if(options->has_cpus && sched_setaffinity(0, sizeof(cpu_set_t), &options->cpus) == -1)
+    {
+        command_error("ERROR: Cannot set the CPU affinity (%s)\n", strerror(errno));
+        return 0;
+    }
+
+    if(options->has_nice || options->policy != -1)
+    {
+        linux_sched_attr_t attr;
+        memset(&attr, 0, sizeof(attr));
+
+        attr.size = sizeof(attr);
+        attr.sched_policy = options->policy != -1 ? options->policy : sched_getscheduler(0) & ~SCHED_RESET_ON_FORK;
+        attr.sched_nice = options->has_nice ? options->nice : getpriority(PRIO_PROCESS, 0);
+
+        if(syscall(SYS_sched_setattr, 0, &attr, 0) == -1)
+        {
+            command_error("ERROR: Cannot set the scheduling policy and nice value (%s)\n", strerror(errno));
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Treatment function of the AFFINITY command.
+ *        The CPUs of the shell are inherited by the programs it runs (and limit the glob threads).
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void affinity_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    cpu_set_t cpus;
+
+    if(cmd_line->nargs > 1)
+    {
+        command_error("ERROR: The affinity command has 0 or 1 arguments\n");
+        return;
+    }
+
+    if(cmd_line->nargs == 1) //set
+    {
+        if(!parse_cpu_list(cmd_line->args[0], &cpus))
+        {
+            command_error("ERROR: Invalid CPU list \'%s\' (e.g. 0-3,6)\n", cmd_line->args[0]);
+            return;
+        }
+
+        if(sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == -1)
+            command_error("ERROR: Cannot set the CPU affinity (%s)\n", strerror(errno));
+        return;
+    }
+
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &cpus) == -1)
+    {
+        command_error("ERROR: Cannot get the CPU affinity\n");
+        return;
+    }
+
+    print_cpu_list(&cpus);
+}
+
+/**
+ * @brief Wait for a child process and make its exit status the status of the last command
+ *        (128 + the signal number for programs killed by a signal, as the shells do).
+ * @param pid  Process ID of the child.
+ */
+void wait_child_status(pid_t pid)
+{
+    int status;
+
+    while(waitpid(pid, &status, 0) == -1)
+    {
+        if(errno != EINTR)
+        {
+            last_status = EXIT_FAILURE;
+            return;
+        }
+    }
+
+    if(WIFEXITED(status)) last_status = WEXITSTATUS(status);
+    else if(WIFSIGNALED(status)) last_status = 128 + WTERMSIG(status);
+    else last_status = EXIT_FAILURE;
+}
+
+/**
+ * @brief Replace the current (child) process by the program in the args of the cmd_line.
+ *        This function only returns to exit the child process on errors.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the options, the path and the arguments of the program.
+ * @param options   Pointer to the options of the EXEC command.
+ */
+void exec_child(cmd_line_t *cmd_line, exec_options_t *options)
+{
+    //build the argv array (without the options)
+    size_t argc = cmd_line->nargs - options->first;
+    char **argv = (char**)calloc(argc+1, sizeof(char*));
+    assert(argv != NULL);
+
+    for( size_t i = 0; i < argc; i++ )
+        argv[i] = cmd_line->args[options->first + i];
+
+    argv[argc] = NULL; //argv must be NULL-terminated
+
+    if(!apply_exec_options(options) || !redirect_child(cmd_line))
+    {
+        fflush(stdout);
+        _exit(EXIT_FAILURE);
+    }
+
+    //change the current process to 'argv[0]', with the exported variables as environment
+    execve(argv[0], argv, shell_envp);
+
+    //execve only returns on errors
+    command_error("ERROR: Cannot execute \'%s\'\n", argv[0]);
+    fflush(stdout);
+    _exit(EXIT_FAILURE);
+}
+
+int warm_launch(cmd_line_t *cmd_line, exec_options_t *options, int *std_fds, pid_t *pid); //defined in the warm pool features
+
+/**
+ * @brief Treatment function of the EXEC command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void exec_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    exec_options_t options;
+
+    if(!parse_exec_options(cmd_line, &options) || !create_exec_cgroup(&options)) return;
+
+    fflush(stdout); //the child must not inherit pending output
+
+    //the program writes where the shell writes (builtins such as UV can run with redirected streams)
+    FILE *streams[3] = {stdin, stdout, stderr};
+    int std_fds[3];
+    for(int fd = 0; fd < 3; fd++)
+        std_fds[fd] = fileno(streams[fd]) != -1 ? fileno(streams[fd]) : fd;
+
+    pid_t my_pid;
+    int warm = warm_launch(cmd_line, &options, std_fds, &my_pid); //ready helper of a warmed program
+
+    if(warm == -1)
+    {
+        remove_exec_cgroup(&options);
+        return;
+    }
+
+    if(!warm) my_pid = fork(); //fork the current process
+
+    if(my_pid == -1) //error flag
+    {
+        command_error("ERROR: Cannot create a process\n");
+        remove_exec_cgroup(&options);
+        return;
+    }
+
+    if( my_pid == 0 ) //if this is the child process
+    {
+        for(int fd = 0; fd < 3; fd++)
+            if(std_fds[fd] != fd) dup2(std_fds[fd], fd);
+
+        exec_child(cmd_line, &options);
+    }
+
+    wait_child_status(my_pid); //wait for the child process
+    remove_exec_cgroup(&options);
+}
+
+/**
+ * @brief Run a builtin command with its redirections: the shell's standard streams are replaced by streams
+ *        of the target files while the command runs, so its output is written straight to the files.
+ *        EXEC applies the redirections in the child process.
+ *        The exit status of the command is 0 unless it reports an error (or EXEC sets the program's status).
+ * @param callback  Treatment function of the command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the expanded arguments.
+ */
+void call_command(void (*callback)(cmd_line_t*), cmd_line_t *cmd_line)
+{
+    last_status = EXIT_SUCCESS;
+
+    if(cmd_line->n_redirects == 0 || callback == exec_command)
+    {
+        callback(cmd_line);
+        return;
+    }
+
+    int fds[cmd_line->n_redirects];
+    if(!open_redirections(cmd_line, fds)) return;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    FILE *terminal[3] = {stdin, stdout, stderr};
+    FILE **streams[3] = {&stdin, &stdout, &stderr};
+    FILE *opened[cmd_line->n_redirects]; //stream of each target file (NULL for '2>&1')
+
+    for(size_t i = 0; i < cmd_line->n_redirects; i++)
+    {
+        int fd = cmd_line->redirects[i].fd;
+        opened[i] = NULL;
+
+        if(fds[i] == -1) //'2>&1'
+        {
+            stderr = stdout;
+            continue;
+        }
+
+        opened[i] = fdopen(fds[i], fd == STDIN_FILENO ? "r" : "w");
+        assert(opened[i] != NULL);
+        setvbuf(opened[i], NULL, _IOFBF, REDIRECT_BUFFER_SIZE); //few large writes
+
+        *streams[fd] = opened[i];
+    }
+
+    callback(cmd_line);
+
+    //close the files and give the streams back to the terminal
+    for(size_t i = 0; i < cmd_line->n_redirects; i++)
+        if(opened[i] != NULL) fclose(opened[i]);
+
+    stdin = terminal[0];
+    stdout = terminal[1];
+    stderr = terminal[2];
+}
+
+#define CAPTURE_PIPE_SIZE (1024*1024) //Requested pipe capacity for captured outputs
+#define CAPTURE_CHUNK_SIZE (64*1024) //Initial size of the capture buffer
+
+/**
+ * @brief Run a program with its stdout connected to a pipe and read all the output.
+ *        The pipe is enlarged (F_SETPIPE_SZ), so the child is rarely blocked and the output is
+ *        read with few large 'read' syscalls into a growable buffer.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the path and the arguments of the program.
+ * @param len       Pointer to where the output length will be stored.
+ * @return The output buffer (NULL-terminated, owned by the caller), or NULL on errors.
+ */
+char *capture_exec_output(cmd_line_t *cmd_line, size_t *len)
+{
+    exec_options_t options;
+    int pipe_fds[2];
+
+    if(!parse_exec_options(cmd_line, &options) || !create_exec_cgroup(&options)) return NULL;
+
+    if(pipe(pipe_fds) == -1)
+    {
+        command_error("ERROR: Cannot create a pipe\n");
+        remove_exec_cgroup(&options);
+        return NULL;
+    }
+
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, CAPTURE_PIPE_SIZE); //bigger pipe (it keeps the default size on errors)
+
+    fflush(stdout); //the child must not inherit pending output
+
+    pid_t my_pid;
+    int std_fds[3] = {STDIN_FILENO, pipe_fds[1], STDERR_FILENO};
+    int warm = warm_launch(cmd_line, &options, std_fds, &my_pid); //ready helper of a warmed program
+
+    if(warm == -1)
+    {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        remove_exec_cgroup(&options);
+        return NULL;
+    }
+
+    if(!warm) my_pid = fork();
+
+    if(my_pid == -1)
+    {
+        command_error("ERROR: Cannot create a process\n");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        remove_exec_cgroup(&options);
+        return NULL;
+    }
+
+    if(my_pid == 0) //child: write stdout to the pipe
+    {
+        close(pipe_fds[0]);
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        close(pipe_fds[1]);
+        exec_child(cmd_line, &options);
+    }
+
+    close(pipe_fds[1]); //only the child writes
+
+    size_t cap = CAPTURE_CHUNK_SIZE;
+    char *buffer = (char*)malloc(cap);
+    assert(buffer != NULL);
+
+    *len = 0;
+    while(1)
+    {
+        if(*len + 1 == cap) //keep room for the '\0'
+        {
+            cap *= 2;
+            buffer = (char*)realloc(buffer, cap);
+            assert(buffer != NULL);
+        }
+
+        ssize_t n_read = read(pipe_fds[0], &buffer[*len], cap - *len - 1);
+
+        if(n_read == -1 && errno == EINTR) continue;
+        if(n_read <= 0) break; //end of output (or error)
+
+        *len += n_read;
+    }
+
+    close(pipe_fds[0]);
+    wait_child_status(my_pid);
+    remove_exec_cgroup(&options);
+
+    buffer[*len] = '\0';
+    return buffer;
+}
+
+/**
+ * @brief Expand a command line (see unexpanded_command) and run it with its output written to a stream instead of the terminal.
+ *        Builtin commands run in this process; programs are launched by the EXEC path, with a pipe.
+ * @param callback  Treatment function of the command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer.
+ * @param output    Stream that receives the output.
+ * @return 1 (true) on success. Otherwise (expansion or launch errors, printed on the terminal), returns 0 (false).
+ */
+int capture_cmd_line(void (*callback)(cmd_line_t*), cmd_line_t *cmd_line, FILE *output)
+{
+    if(!unexpanded_command(cmd_line->command) && !expand_cmd_line(cmd_line)) return 0;
+
+    if(callback == exec_command) //external program: capture through a pipe
+    {
+        size_t program_len = 0;
+        char *program_output = capture_exec_output(cmd_line, &program_len);
+
+        if(program_output == NULL) return 0;
+
+        fwrite(program_output, 1, program_len, output);
+        free(program_output);
+        return 1;
+    }
+
+    //builtin: run it in this process, with stdout in memory
+    FILE *terminal = stdout;
+
+    stdout = output;
+    call_command(callback, cmd_line);
+    stdout = terminal;
+
+    return 1;
+}
+
+/**
+ * @brief Run a command line and capture its output (the text of a '$(command)' substitution).
+ *        The line can be a list ('$(cmd ; cmd && cmd)'): the outputs of its commands are concatenated.
+ *        Builtin commands run in this process, writing to a memory stream instead of the terminal.
+ *        Trailing newlines are removed from the output.
+ * @param text  Command line text (without '$(' and ')').
+ * @return The output buffer (owned by the caller), or NULL on errors.
+ */
+char *capture_command_output(char *text)
+{
+    if(blank_string(text))
+    {
+        command_error("ERROR: Empty command substitution\n");
+        return NULL;
+    }
+
+    cmd_list_t *list = create_cmd_list();
+
+    if(parse_cmd_list(list, text) != LINE_READ)
+    {
+        destroy_cmd_list(list);
+        return NULL;
+    }
+
+    alphabetical_tree_node_t *nodes[list->n_cmds];
+
+    for(size_t i = 0; i < list->n_cmds; i++)
+    {
+        cmd_line_t *cmd_line = list->cmds[i];
+        nodes[i] = NULL;
+
+        if(alphabetical_string(cmd_line->command))
+            nodes[i] = find_token_in_tree(dictionary, cmd_line->command);
+
+        if(nodes[i] == NULL || nodes[i]->cmd_callback == NULL)
+        {
+            command_error("ERROR: Command \'%s\' not found\n", cmd_line->command);
+            destroy_cmd_list(list);
+            return NULL;
+        }
+    }
+
+    char *buffer = NULL;
+    size_t len = 0;
+    int failed = 0;
+
+    fflush(stdout);
+
+    FILE *output = open_memstream(&buffer, &len);
+    assert(output != NULL);
+
+    for(size_t i = 0; i < list->n_cmds && !failed; i++)
+    {
+        if(i > 0 && !list_command_runs(list->cmds[i-1]->next_op)) continue;
+
+        failed = !capture_cmd_line(nodes[i]->cmd_callback, list->cmds[i], output);
+    }
+
+    fclose(output); //sets 'buffer' and 'len'
+    destroy_cmd_list(list);
+
+    if(failed)
+    {
+        free(buffer);
+        return NULL;
+    }
+
+    while(len > 0 && buffer[len-1] == '\n') len--; //trim trailing newlines
+    buffer[len] = '\0';
+
+    return buffer;
+}
+
+#define WATCH_DEFAULT_INTERVAL 2.0 //Interval (seconds) of the WATCH command without '-n'
+
+/**
+ * @brief Output of a WATCH tick, split into lines.
+ * @param text     Output text (the '\n' are replaced by '\0').
+ * @param lines    Pointer to each line in the text.
+ * @param n_lines  Number of lines.
+ */
+typedef struct
+{
+    char *text;
+    char **lines;
+    size_t n_lines, cap_lines;
+} watch_frame_t;
+
+/**
+ * @brief Split the output of a tick into the lines of a frame (the frame takes the text).
+ */
+void split_watch_frame(watch_frame_t *frame, char *text, size_t len)
+{
+    frame->text = text;
+    frame->n_lines = 0;
+
+    while(len > 0 && text[len-1] == '\n') text[--len] = '\0'; //trailing newlines
+
+    for(char *line = text; len > 0 && line != NULL; )
+    {
+        grow_array((void**)&frame->lines, &frame->cap_lines, frame->n_lines, sizeof(char*));
+        frame->lines[frame->n_lines++] = line;
+
+        line = strchr(line, '\n');
+        if(line != NULL) *line++ = '\0';
+    }
+}
+
+/**
+ * @brief Print a frame of the WATCH command on the terminal, redrawing only the lines that changed.
+ * @param out     Stream of the drawing (written to the terminal at once).
+ * @param frame   Frame of this tick.
+ * @param prev    Frame of the previous tick (NULL for the first frame).
+ * @param header  Header line (redrawn in every frame).
+ */
+void draw_watch_frame(FILE *out, watch_frame_t *frame, watch_frame_t *prev, char *header)
+{
+    struct winsize size;
+    size_t width = 80, rows = 24;
+
+    if(ioctl(fileno(stdout), TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 1)
+    {
+        width = size.ws_col;
+        rows = size.ws_row;
+    }
+
+    if(prev == NULL) fprintf(out, "\033[H\033[2J"); //clear the screen
+
+    fprintf(out, "\033[1;1H%.*s\033[K", (int)width, header);
+
+    size_t n_lines = frame->n_lines < rows - 1 ? frame->n_lines : rows - 1; //lines below the header
+    size_t n_prev = prev == NULL ? 0 : (prev->n_lines < rows - 1 ? prev->n_lines : rows - 1);
+
+    for(size_t i = 0; i < n_lines; i++)
+        if(i >= n_prev || strcmp(frame->lines[i], prev->lines[i]))
+            fprintf(out, "\033[%zu;1H%.*s\033[K", i+2, (int)width, frame->lines[i]);
+
+    if(n_lines < n_prev) //clear the lines of the longer previous frame
+        fprintf(out, "\033[%zu;1H\033[J", n_lines+2);
+
+    fprintf(out, "\033[%zu;1H", n_lines+2); //cursor below the output
+}
+
+/**
+ * @brief Treatment function of the WATCH command: run a command periodically and show its output.
+ *        The ticks are absolute deadlines of a timerfd (interval, 2 intervals, ...), so they do not drift with
+ *        the time taken by the command. The command is parsed once; its arguments are expanded on each tick.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void watch_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    double interval = WATCH_DEFAULT_INTERVAL;
+    unsigned long count = 0; //0 means until 'q'
+    size_t first = 0; //token of the watched command
+
+    //the options and the command are read from the typed tokens (the command is expanded on each tick)
+    while(first + 1 < cmd_line->n_tokens && cmd_line->tokens[first][0] == '-')
+    {
+        char *option = cmd_line->tokens[first], *end = NULL;
+
+        if(!strcmp(option, "-n")) interval = strtod(cmd_line->tokens[first+1], &end);
+        else if(!strcmp(option, "-c")) count = strtoul(cmd_line->tokens[first+1], &end, 10);
+
+        if(end == NULL || *end != '\0' || end == cmd_line->tokens[first+1] || interval < 0.001 || interval > 86400)
+        {
+            command_error("ERROR: The watch syntax is: watch [-n seconds] [-c count] command [args]\n");
+            return;
+        }
+
+        first += 2;
+    }
+
+    if(first >= cmd_line->n_tokens || !alphabetical_string(cmd_line->tokens[first]))
+    {
+        command_error("ERROR: The watch syntax is: watch [-n seconds] [-c count] command [args]\n");
+        return;
+    }
+
+    //the watched command, parsed once
+    cmd_line_t *watched = create_cmd_line();
+    set_cmd_line_command(watched, cmd_line->tokens[first]);
+    string_to_lower(watched->command);
+
+    size_t n_args = cmd_line->n_tokens - first - 1;
+    if(n_args > 0) init_cmd_line_args(watched, n_args);
+    for(size_t i = 0; i < n_args; i++)
+        set_cmd_line_arg(watched, cmd_line->tokens[first + 1 + i], i);
+
+    alphabetical_tree_node_t *node = find_token_in_tree(dictionary, watched->command);
+
+    if(node == NULL || node->cmd_callback == NULL || block_keyword(watched->command))
+    {
+        command_error("ERROR: Command \'%s\' cannot be watched\n", watched->command);
+        destroy_cmd_line(watched);
+        return;
+    }
+
+    //text of the command, for the header
+    char title[MAX_TOKEN_LEN];
+    size_t title_len = snprintf(title, sizeof(title), "%s", watched->command);
+    for(size_t i = 0; i < n_args && title_len < sizeof(title); i++)
+        title_len += snprintf(&title[title_len], sizeof(title) - title_len, " %s", watched->tokens[i]);
+
+    //periodic timer on absolute deadlines: start, start + interval, start + 2 intervals, ...
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    struct itimerspec spec;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    spec.it_value = start;
+    spec.it_interval.tv_sec = (time_t)interval;
+    spec.it_interval.tv_nsec = (long)((interval - (time_t)interval) * 1e9);
+
+    if(timer == -1 || timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+    {
+        command_error("ERROR: Cannot create the timer of the watch command\n");
+        if(timer != -1) close(timer);
+        destroy_cmd_line(watched);
+        return;
+    }
+
+    int tty = isatty(fileno(stdout));
+    int keys = tty && isatty(STDIN_FILENO); //'q' stops the command
+    struct termios cooked, raw;
+
+    if(keys)
+    {
+        tcgetattr(STDIN_FILENO, &cooked);
+        raw = cooked;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG); //byte by byte, without echo and signals (Ctrl-C is a key)
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+
+    watch_frame_t frames[2];
+    memset(frames, 0, sizeof(frames));
+    watch_frame_t *prev = NULL;
+
+    uint64_t ticks = 0; //expirations of the timer (missed ticks included)
+    unsigned long runs = 0;
+    int stop = 0;
+
+    while(!stop && (count == 0 || runs < count))
+    {
+        struct pollfd fds[2] = {{timer, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+
+        if(poll(fds, keys ? 2 : 1, -1) == -1)
+        {
+            if(errno == EINTR) continue;
+            break;
+        }
+
+        if(keys && (fds[1].revents & POLLIN))
+        {
+            char key = 0;
+            if(read(STDIN_FILENO, &key, 1) != 1 || key == 'q' || key == 3 || key == 4) stop = 1; //q, Ctrl-C, Ctrl-D
+            continue;
+        }
+
+        uint64_t expirations;
+        if(read(timer, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+        ticks += expirations;
+
+        //lateness of this tick from its deadline
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double late_ms = (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_nsec - start.tv_nsec) / 1e6 - (ticks - 1) * interval * 1e3;
+
+        //run the command with its output in memory
+        char *text = NULL;
+        size_t len = 0;
+
+        fflush(stdout);
+        FILE *output = open_memstream(&text, &len);
+        assert(output != NULL);
+
+        capture_cmd_line(node->cmd_callback, watched, output);
+        fclose(output);
+
+        watch_frame_t *frame = &frames[runs % 2];
+        split_watch_frame(frame, text, len);
+        runs++;
+
+        char header[MAX_TOKEN_LEN + 128];
+        snprintf(header, sizeof(header), "Every %.3fs: %s    (tick %llu, %+.3f ms%s)", interval, title,
+                 (unsigned long long)ticks, late_ms, keys ? ", q to quit" : "");
+
+        if(tty)
+        {
+            //the frame is drawn with a single write
+            char *drawing = NULL;
+            size_t drawing_len = 0;
+            FILE *out = open_memstream(&drawing, &drawing_len);
+            assert(out != NULL);
+
+            draw_watch_frame(out, frame, prev, header);
+            fclose(out);
+
+            fwrite(drawing, 1, drawing_len, stdout);
+            fflush(stdout);
+            free(drawing);
+        }
+        else //other outputs (files, pipes) get the frames that changed
+        {
+            int changed = prev == NULL || prev->n_lines != frame->n_lines;
+            for(size_t i = 0; !changed && i < frame->n_lines; i++)
+                changed = strcmp(frame->lines[i], prev->lines[i]) != 0;
+
+            if(changed)
+            {
+                printf("%s\n", header);
+                for(size_t i = 0; i < frame->n_lines; i++)
+                    printf("%s\n", frame->lines[i]);
+            }
+        }
+
+        if(prev != NULL) free(prev->text);
+        prev = frame;
+    }
+
+    if(keys) tcsetattr(STDIN_FILENO, TCSANOW, &cooked);
+
+    if(prev != NULL) free(prev->text);
+    free(frames[0].lines);
+    free(frames[1].lines);
+
+    close(timer);
+    destroy_cmd_line(watched);
+}
+
+/**
+ * @brief Treatment function of the SET command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void set_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+    assert(variables != NULL);
+
+    if(cmd_line->nargs != 3)
+    {
+        command_error("ERROR: The set command has 3 arguments\n");
+        print_cmd_line(cmd_line);
+        return;
+    }
+
+    char *dest_var = cmd_line->args[0]; //destination variable name
+    char *text = NULL; //text that will be stored in the variable
+
+    if(!alphabetical_string(dest_var))
+    {
+        command_error("ERROR: Variable's names must have only alphabetical chars\n");
+        return;
+    }
+
+    if(!strcmp(cmd_line->args[1], "as")) // variable <- text
+    {
+        if(cmd_line->n_tokens == 3 && cmd_line->outputs[2] != NULL && cmd_line->args[2] == cmd_line->outputs[2])
+        {   // variable <- $(command): the variable takes the captured output buffer
+            assign_variable_buffer(variable_slot(dest_var), cmd_line->outputs[2]);
+            cmd_line->outputs[2] = NULL;
+            return;
+        }
+
+        text = cmd_line->args[2];
+    }
+    else if(!strcmp(cmd_line->args[1], "like")) // variable <- variable
+    {
+        char *origin_var = cmd_line->args[2];
+
+        if(!alphabetical_string(origin_var))
+        {
+            command_error("ERROR: Variable's names must have only alphabetical chars\n");
+            return;
+        }
+
+        alphabetical_tree_node_t *n = find_variable(origin_var);
+
+        if(n == NULL || n->text == NULL)
+        {
+            command_error("ERROR: Variable \'%s\' not found\n", origin_var);
+            return;
+        }
+
+        if(n->value.type != VALUE_TEXT) //numbers are copied in binary
+        {
+            assign_variable_number(variable_slot(dest_var), &n->value);
+            return;
+        }
+
+        text = n->text;
+    }
+    else
+    {
+        command_error("ERROR: Missing \'as\' or \'like\' (lowercase) statement.\n"
+               "The syntax of \'store\' command is: set [var] as [text].\n"
+               "\tor: set [dest_var] like [origin_var]\n"
+               "Example: set dev_path as \\dev\n"
+               "Example: set dev_path_2 like dev_path\n"
+               );
+        return;
+    }
+
+    assign_variable(variable_slot(dest_var), text);
+}
+
+/**
+ * @brief Treatment function of the EXPORT command.
+ *        Without arguments, prints the environment given to the executed programs.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void export_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(cmd_line->nargs == 0)
+    {
+        for(size_t i = 0; i < n_envp; i++)
+            printf("%s\n", shell_envp[i]);
+        return;
+    }
+
+    for(size_t i = 0; i < cmd_line->nargs; i++)
+    {
+        //the variable's name is lowercase, the environment's name keeps the typed case (export PATH exports $path)
+        char name[MAX_TOKEN_LEN];
+
+        if(strlen(cmd_line->args[i]) >= MAX_TOKEN_LEN) //expanded args ($varname, $(command)) have any length
+        {
+            command_error("ERROR: Variable's names have less than %d chars\n", MAX_TOKEN_LEN);
+            return;
+        }
+
+        strcpy(name, cmd_line->args[i]);
+        string_to_lower(name);
+
+        if(name[0] == '\0' || !alphabetical_string(name))
+        {
+            command_error("ERROR: Variable's names must have only alphabetical chars\n");
+            return;
+        }
+
+        alphabetical_tree_node_t *slot = variable_slot(name);
+
+        if(slot->env_name != NULL) continue; //already exported
+
+        slot->env_name = strdup(cmd_line->args[i]);
+        assert(slot->env_name != NULL);
+
+        update_env_entry(slot); //adds the envp entry if the variable has content
+    }
+}
+
+/**
+ * @brief Treatment function of the PRINT command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void print_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(cmd_line->nargs < 1)
+    {
+        command_error("ERROR: The print command has at least 1 argument\n");
+        print_cmd_line(cmd_line);
+        return;
+    }
+
+    for(int i = 0; i < cmd_line->nargs; i++)
+        printf(i == 0 ? "%s" : " %s", cmd_line->args[i]); //variables have already been expanded
+
+    printf("\n");
+}
+
+/**
+ * @brief Treatment function of the UV command.
+ *        Variables are expanded for every command now, so UV only runs its first argument as a command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void uv_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(cmd_line->nargs < 2)
+    {
+        command_error("ERROR: The uv command has at least 2 arguments\n");
+        print_cmd_line(cmd_line);
+        return;
+    }
+
+    cmd_line_t *new_cmd_line = create_cmd_line();
+    set_cmd_line_command(new_cmd_line, cmd_line->args[0]);
+    init_cmd_line_args(new_cmd_line, cmd_line->nargs-1);
+
+    for(int i = 1; i < cmd_line->nargs; i++)
+        set_cmd_line_arg(new_cmd_line, cmd_line->args[i], i-1);
+
+    new_cmd_line->generation = variables_generation; //the args are already expanded (do not expand contents again)
+
+    run_command(dictionary, new_cmd_line);
+    destroy_cmd_line(new_cmd_line);
+}
+
+/**
+ * @brief Print text content for each node in the alphabetical subtree
+ * @param node  Pointer to the root of the alphabetical subtree
+ */
+void print_subtree_texts(alphabetical_tree_node_t *node)
+{
+    if(node != NULL)
+    {
+        if(node->text != NULL) printf("%s\n", node->text);
+
+        for(int i = 0; i < ALPHABETICAL_TREE_ENTRIES; i++)
+            print_subtree_texts(node->next[i]);
+    }
+}
+
+/**
+ * @brief Treatment function of the HELP command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void help_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(cmd_line->nargs != 0)
+        fprintf(stderr, "WARNING: The \'help\' command has no arguments\n\n");
+
+    printf("Command line syntax:\n"
+           "* No arguments:\t\t[command]\n"
+           "* Single argument:\t[command] [arg]\n"
+           "* N arguments:\t\t[command] [arg_0] [arg_1] ... [arg_{N-1}]\n"
+           "\n"
+           "---- COMMANDS ----\n\n"
+           );
+
+    for(int i = 0; i < ALPHABETICAL_TREE_ENTRIES; i++)
+    {
+        print_subtree_texts(dictionary->entries[i]);
+    }
+}
+
+
+// =============================================
+// =============== GLOB FEATURES ===============
+// =============================================
+
+/*
+ * Arguments with '*', '?' or '[...]' are glob patterns. A pattern is compiled once per cmd_line
+ * (split on '/' into segments of match operations) and expanded on each run: each directory is read
+ * once with 'getdents64' and its names are matched in place, without 'stat' calls unless the file
+ * system does not report the entrie types. A '**' segment matches zero or more directories; its
+ * top-level subdirectories are walked in parallel by a small pool of threads. The matches are sorted,
+ * and a pattern without matches is kept as it was typed.
+ */
+
+#define GLOB_PATH_MAX 4096 //Maximum length of a matched path
+#define GLOB_DENTS_BUFFER_SIZE (64*1024) //Buffer size for each 'getdents64' syscall of the glob walk
+#define GLOB_MAX_THREADS 8 //Maximum number of threads walking a '**' segment
+
+/**
+ * @brief Codes of the glob match operations.
+ */
+typedef enum
+{
+    GLOB_CHAR, //one given char
+    GLOB_ANY, //any char ('?')
+    GLOB_STAR, //any sequence of chars ('*')
+    GLOB_SET //one char of a set ('[abc]', '[a-z]', '[!abc]')
+} glob_op_code_t;
+
+/**
+ * @brief Match operation of a glob segment.
+ * @param code  Operation code (glob_op_code_t).
+ * @param c     Char of a GLOB_CHAR operation.
+ * @param set   Bitmap of the chars of a GLOB_SET operation.
+ */
+typedef struct
+{
+    unsigned char code;
+    unsigned char c;
+    unsigned char set[32];
+} glob_op_t;
+
+/**
+ * @brief Part of a glob pattern between two '/'.
+ * @param ops        Match operations (NULL for literal and '**' segments).
+ * @param n_ops      Number of match operations.
+ * @param literal    Text of a segment without wildcards (NULL for other segments).
+ * @param recursive  1 (true) if the segment is '**'. Otherwise, 0 (false).
+ * @param hidden     1 (true) if the segment begins with '.' and can match hidden names. Otherwise, 0 (false).
+ */
+typedef struct
+{
+    glob_op_t *ops;
+    size_t n_ops;
+    char *literal;
+    int recursive;
+    int hidden;
+} glob_segment_t;
+
+/**
+ * @brief Compiled glob pattern.
+ * @param segments      Segments of the pattern.
+ * @param n_segments    Number of segments.
+ * @param cap_segments  Capacity of the segments array.
+ * @param absolute      1 (true) if the pattern begins with '/'. Otherwise, 0 (false).
+ */
+struct glob_pattern
+{
+    glob_segment_t *segments;
+    size_t n_segments, cap_segments;
+    int absolute;
+};
+
+/**
+ * @brief State of a glob walk (one per thread).
+ * @param pattern    Pattern being matched.
+ * @param storage    Storage where the matched paths are added.
+ * @param dents      Buffer of the 'getdents64' syscalls.
+ * @param parallel   1 (true) if the next '**' segment can be walked by several threads. Otherwise, 0 (false).
+ * @param path       Path of the current directory.
+ */
+typedef struct
+{
+    struct glob_pattern *pattern;
+    arg_storage_t *storage;
+    char *dents;
+    int parallel;
+    char path[GLOB_PATH_MAX];
+} glob_walk_t;
+
+/**
+ * @brief Append a string to the storage.
+ * @param storage   Pointer to the storage.
+ * @param str       String.
+ * @param len       Length of the string.
+ */
+void append_arg_storage(arg_storage_t *storage, char *str, size_t len)
+{
+    assert(storage != NULL);
+
+    while(storage->len + len + 1 > storage->cap)
+    {
+        storage->cap = storage->cap == 0 ? 4096 : storage->cap * 2;
+        storage->data = realloc(storage->data, storage->cap);
+        assert(storage->data != NULL);
+    }
+
+    grow_array((void**)&storage->offsets, &storage->cap_offsets, storage->n_offsets, sizeof(size_t));
+    storage->offsets[storage->n_offsets++] = storage->len;
+
+    memcpy(&storage->data[storage->len], str, len);
+    storage->data[storage->len + len] = '\0';
+    storage->len += len + 1;
+}
+
+/**
+ * @brief Add a segment to the glob pattern.
+ * @param pattern   Pointer to the pattern.
+ * @param text      Text of the segment (not null-terminated).
+ * @param len       Length of the segment.
+ */
+void compile_glob_segment(struct glob_pattern *pattern, char *text, size_t len)
+{
+    int recursive = len == 2 && text[0] == '*' && text[1] == '*';
+
+    //'**/**' is the same as '**'
+    if(recursive && pattern->n_segments > 0 && pattern->segments[pattern->n_segments-1].recursive) return;
+
+    grow_array((void**)&pattern->segments, &pattern->cap_segments, pattern->n_segments, sizeof(glob_segment_t));
+    glob_segment_t *segment = &pattern->segments[pattern->n_segments++];
+    memset(segment, 0, sizeof(glob_segment_t));
+
+    segment->recursive = recursive;
+    segment->hidden = text[0] == '.';
+    if(recursive) return;
+
+    segment->ops = (glob_op_t*)calloc(len, sizeof(glob_op_t));
+    assert(segment->ops != NULL);
+
+    char *literal = (char*)calloc(len+1, sizeof(char)); //segment text without escapes
+    assert(literal != NULL);
+
+    size_t literal_len = 0;
+    int wildcards = 0;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        glob_op_t *op = &segment->ops[segment->n_ops];
+
+        if(text[i] == '*')
+        {
+            wildcards = 1;
+            if(segment->n_ops > 0 && op[-1].code == GLOB_STAR) continue; //'**' inside a name is '*'
+            op->code = GLOB_STAR;
+        }
+        else if(text[i] == '?')
+        {
+            wildcards = 1;
+            op->code = GLOB_ANY;
+        }
+        else if(text[i] == '[' && i+1 < len)
+        {
+            size_t j = i+1;
+            int negate = text[j] == '!' || text[j] == '^';
+            if(negate) j++;
+
+            size_t set_start = j;
+            if(j < len && text[j] == ']') j++; //']' just after '[' is a member of the set
+            while(j < len && text[j] != ']') j++;
+
+            if(j >= len) //no closing ']': '[' is a plain char
+            {
+                op->code = GLOB_CHAR;
+                op->c = '[';
+                literal[literal_len++] = '[';
+            }
+            else
+            {
+                wildcards = 1;
+                op->code = GLOB_SET;
+
+                for(size_t k = set_start; k < j; k++)
+                {
+                    unsigned int low = (unsigned char)text[k], high = low;
+
+                    if(k+2 < j && text[k+1] == '-') //range 'a-z'
+                    {
+                        high = (unsigned char)text[k+2];
+                        k += 2;
+                    }
+
+                    for(unsigned int c = low; c <= high; c++)
+                        op->set[c / 8] |= 1 << (c % 8);
+                }
+
+                if(negate)
+                    for(size_t k = 0; k < sizeof(op->set); k++)
+                        op->set[k] = ~op->set[k];
+
+                i = j;
+            }
+        }
+        else
+        {
+            if(text[i] == '\\' && i+1 < len) i++; //escaped char
+            op->code = GLOB_CHAR;
+            op->c = text[i];
+            literal[literal_len++] = text[i];
+        }
+
+        segment->n_ops++;
+    }
+
+    if(wildcards)
+        free(literal);
+    else //the segment is a plain name
+    {
+        free(segment->ops);
+        segment->ops = NULL;
+        segment->n_ops = 0;
+        segment->literal = literal;
+    }
+}
+
+/**
+ * @brief Compile a glob pattern.
+ * @param token   Pattern text.
+ * @return Pointer to the compiled pattern.
+ */
+struct glob_pattern *compile_glob_pattern(char *token)
+{
+    assert(token != NULL);
+
+    struct glob_pattern *pattern = (struct glob_pattern*)calloc(1, sizeof(struct glob_pattern));
+    assert(pattern != NULL);
+
+    pattern->absolute = token[0] == '/';
+
+    for(char *segment = token; *segment != '\0';)
+    {
+        while(*segment == '/') segment++; //'a//b' is the same as 'a/b'
+        if(*segment == '\0') break;
+
+        size_t len = strcspn(segment, "/");
+        compile_glob_segment(pattern, segment, len);
+        segment += len;
+    }
+
+    //a trailing '**' matches all names in the subdirectories
+    if(pattern->n_segments > 0 && pattern->segments[pattern->n_segments-1].recursive)
+        compile_glob_segment(pattern, "*", 1);
+
+    return pattern;
+}
+
+/**
+ * @brief Free a compiled glob pattern.
+ * @param pattern   Pointer to the pattern.
+ */
+void destroy_glob_pattern(struct glob_pattern *pattern)
+{
+    assert(pattern != NULL);
+
+    for(size_t i = 0; i < pattern->n_segments; i++)
+    {
+        free(pattern->segments[i].ops);
+        free(pattern->segments[i].literal);
+    }
+
+    free(pattern->segments);
+    free(pattern);
+}
+
+/**
+ * @brief Check if a name matches a glob segment.
+ *        A '*' is retried from the char after its last start only when the rest does not match.
+ * @param segment   Pointer to the segment.
+ * @param name      Name (null-terminated).
+ * @return 1 (true) if the name matches. Otherwise, 0 (false).
+ */
+int match_glob_segment(glob_segment_t *segment, char *name)
+{
+    if(name[0] == '.' && !segment->hidden) return 0; //hidden names must be matched explicitly
+
+    glob_op_t *ops = segment->ops;
+    size_t op = 0, star_op = 0;
+    char *star_name = NULL; //where the last '*' began to match
+
+    while(*name != '\0')
+    {
+        if(op < segment->n_ops)
+        {
+            unsigned char c = *name;
+
+            if(ops[op].code == GLOB_STAR)
+            {
+                star_op = op++;
+                star_name = name;
+                continue;
+            }
+
+            if((ops[op].code == GLOB_CHAR && ops[op].c == c) || ops[op].code == GLOB_ANY ||
+               (ops[op].code == GLOB_SET && (ops[op].set[c / 8] & (1 << (c % 8)))))
+            {
+                op++;
+                name++;
+                continue;
+            }
+        }
+
+        if(star_name == NULL) return 0;
+
+        //backtrack: the last '*' takes one more char
+        op = star_op + 1;
+        name = ++star_name;
+    }
+
+    while(op < segment->n_ops && ops[op].code == GLOB_STAR) op++;
+
+    return op == segment->n_ops;
+}
+
+/**
+ * @brief Append a name to the current path of the walk.
+ * @param walk       Pointer to the walk.
+ * @param path_len   Length of the current path.
+ * @param name       Name.
+ * @return The length of the new path, or 0 if it is too long.
+ */
+size_t join_glob_path(glob_walk_t *walk, size_t path_len, char *name)
+{
+    size_t name_len = strlen(name);
+    int slash = path_len > 0 && walk->path[path_len-1] != '/';
+
+    if(path_len + slash + name_len + 1 > GLOB_PATH_MAX) return 0;
+
+    if(slash) walk->path[path_len++] = '/';
+    memcpy(&walk->path[path_len], name, name_len+1);
+
+    return path_len + name_len;
+}
+
+/**
+ * @brief Get the type of a directory entrie whose type is not reported by 'getdents64'.
+ */
+unsigned char glob_entry_type(int dirfd, char *name)
+{
+    struct stat st;
+
+    if(fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) return DT_UNKNOWN;
+    if(S_ISDIR(st.st_mode)) return DT_DIR;
+    if(S_ISLNK(st.st_mode)) return DT_LNK;
+
+    return DT_REG;
+}
+
+void glob_scan(glob_walk_t *walk, int dirfd, size_t path_len, size_t segi);
+
+/**
+ * @brief Open a subdirectory and match the next segments in it.
+ * @param walk       Pointer to the walk.
+ * @param dirfd      Descriptor of the current directory.
+ * @param path_len   Length of the path of the current directory.
+ * @param name       Name of the subdirectory.
+ * @param segi       Index of the segment to match in the subdirectory.
+ */
+void glob_descend(glob_walk_t *walk, int dirfd, size_t path_len, char *name, size_t segi)
+{
+    size_t len = join_glob_path(walk, path_len, name);
+    if(len == 0) return;
+
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1) return; //not a directory or not readable
+
+    glob_scan(walk, fd, len, segi);
+    close(fd);
+}
+
+/**
+ * @brief Subdirectories of a '**' segment shared by the glob threads.
+ * @param parent     Walk that found the subdirectories.
+ * @param dirfd      Descriptor of the directory of the subdirectories.
+ * @param path_len   Length of the path of the directory.
+ * @param segi       Index of the '**' segment.
+ * @param subdirs    Names of the subdirectories.
+ * @param next       Index of the next subdirectory to walk (atomic).
+ */
+typedef struct
+{
+    glob_walk_t *parent;
+    int dirfd;
+    size_t path_len;
+    size_t segi;
+    arg_storage_t *subdirs;
+    size_t next;
+} glob_jobs_t;
+
+/**
+ * @brief Glob thread: a walk with its own storage.
+ */
+typedef struct
+{
+    glob_jobs_t *jobs;
+    glob_walk_t walk;
+    arg_storage_t storage;
+    pthread_t thread;
+} glob_worker_t;
+
+/**
+ * @brief Walk the shared subdirectories until there are none left.
+ * @param data   Pointer to the glob_worker_t of the thread.
+ */
+void *glob_worker(void *data)
+{
+    glob_worker_t *worker = (glob_worker_t*)data;
+    glob_jobs_t *jobs = worker->jobs;
+    size_t i;
+
+    while((i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED)) < jobs->subdirs->n_offsets)
+        glob_descend(&worker->walk, jobs->dirfd, jobs->path_len, &jobs->subdirs->data[jobs->subdirs->offsets[i]], jobs->segi);
+
+    return NULL;
+}
+
+/**
+ * @brief Walk the subdirectories of a '**' segment with up to GLOB_MAX_THREADS threads (one per CPU).
+ *        The calling thread is one of the workers, so the walk finishes even if no thread can be created.
+ * @param walk       Pointer to the walk.
+ * @param dirfd      Descriptor of the directory of the subdirectories.
+ * @param path_len   Length of the path of the directory.
+ * @param segi       Index of the '**' segment.
+ * @param subdirs    Names of the subdirectories.
+ */
+void glob_scan_parallel(glob_walk_t *walk, int dirfd, size_t path_len, size_t segi, arg_storage_t *subdirs)
+{
+    cpu_set_t cpus; //CPUs of the shell (see the AFFINITY command)
+    size_t n_workers = sched_getaffinity(0, sizeof(cpu_set_t), &cpus) == 0 ? CPU_COUNT(&cpus) : sysconf(_SC_NPROCESSORS_ONLN);
+    if(n_workers > GLOB_MAX_THREADS) n_workers = GLOB_MAX_THREADS;
+    if(n_workers > subdirs->n_offsets) n_workers = subdirs->n_offsets;
+    if(n_workers < 1) n_workers = 1;
+
+    glob_jobs_t jobs = {walk, dirfd, path_len, segi, subdirs, 0};
+
+    glob_worker_t *workers = (glob_worker_t*)calloc(n_workers, sizeof(glob_worker_t));
+    assert(workers != NULL);
+
+    size_t n_threads = 1; //workers[0] is the calling thread
+
+    for(size_t w = 0; w < n_workers; w++)
+    {
+        workers[w].jobs = &jobs;
+        workers[w].walk.pattern = walk->pattern;
+        workers[w].walk.storage = &workers[w].storage;
+        workers[w].walk.dents = (char*)malloc(GLOB_DENTS_BUFFER_SIZE);
+        assert(workers[w].walk.dents != NULL);
+        memcpy(workers[w].walk.path, walk->path, path_len);
+
+        if(w > 0 && w == n_threads && pthread_create(&workers[w].thread, NULL, glob_worker, &workers[w]) == 0)
+            n_threads++;
+    }
+
+    glob_worker(&workers[0]);
+
+    for(size_t w = 0; w < n_workers; w++)
+    {
+        if(w > 0 && w < n_threads) pthread_join(workers[w].thread, NULL);
+
+        //merge the matches of the worker
+        arg_storage_t *storage = &workers[w].storage;
+        for(size_t i = 0; i < storage->n_offsets; i++)
+        {
+            char *match = &storage->data[storage->offsets[i]];
+            append_arg_storage(walk->storage, match, strlen(match));
+        }
+
+        free(storage->data);
+        free(storage->offsets);
+        free(workers[w].walk.dents);
+    }
+
+    free(workers);
+}
+
+/**
+ * @brief Match the segments of the pattern from 'segi' in a directory (read once).
+ * @param walk       Pointer to the walk.
+ * @param dirfd      Descriptor of the directory.
+ * @param path_len   Length of the path of the directory.
+ * @param segi       Index of the segment to match.
+ */
+void glob_scan(glob_walk_t *walk, int dirfd, size_t path_len, size_t segi)
+{
+    struct glob_pattern *pattern = walk->pattern;
+    glob_segment_t *segment = &pattern->segments[segi];
+
+    //'**' also matches zero directories, so the next segment is matched in this directory
+    size_t match_segi = segment->recursive ? segi+1 : segi;
+    glob_segment_t *match_segment = &pattern->segments[match_segi];
+    int last = match_segi+1 == pattern->n_segments;
+
+    arg_storage_t matched = {0}; //matched subdirectories (next segment)
+    arg_storage_t subdirs = {0}; //subdirectories of a '**' segment (same segment)
+
+    if(match_segment->literal != NULL) //plain name: the directory is not read to match it
+    {
+        struct stat st;
+
+        if(fstatat(dirfd, match_segment->literal, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+            if(!last)
+                append_arg_storage(&matched, match_segment->literal, strlen(match_segment->literal));
+            else
+            {
+                size_t len = join_glob_path(walk, path_len, match_segment->literal);
+                if(len > 0) append_arg_storage(walk->storage, walk->path, len);
+            }
+        }
+    }
+
+    if(match_segment->literal == NULL || segment->recursive)
+    {
+        long n_read;
+
+        while((n_read = syscall(SYS_getdents64, dirfd, walk->dents, GLOB_DENTS_BUFFER_SIZE)) > 0)
+        {
+            for(long offset = 0; offset < n_read; offset += ((linux_dirent64_t*)(walk->dents + offset))->d_reclen)
+            {
+                linux_dirent64_t *entrie = (linux_dirent64_t*)(walk->dents + offset);
+                char *name = entrie->d_name;
+
+                if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue; //ignore '.' and '..'
+
+                unsigned char type = entrie->d_type;
+                if(type == DT_UNKNOWN) type = glob_entry_type(dirfd, name);
+
+                if(match_segment->literal == NULL && match_glob_segment(match_segment, name))
+                {
+                    if(last)
+                    {
+                        size_t len = join_glob_path(walk, path_len, name);
+                        if(len > 0) append_arg_storage(walk->storage, walk->path, len);
+                    }
+                    else if(type == DT_DIR || type == DT_LNK) //links can point to directories
+                        append_arg_storage(&matched, name, strlen(name));
+                }
+
+                if(segment->recursive && type == DT_DIR && name[0] != '.') //'**' does not follow links nor hidden dirs
+                    append_arg_storage(&subdirs, name, strlen(name));
+            }
+        }
+    }
+
+    for(size_t i = 0; i < matched.n_offsets; i++)
+        glob_descend(walk, dirfd, path_len, &matched.data[matched.offsets[i]], match_segi+1);
+
+    if(subdirs.n_offsets > 1 && walk->parallel)
+    {
+        walk->parallel = 0; //only the first '**' directory is split among threads
+        glob_scan_parallel(walk, dirfd, path_len, segi, &subdirs);
+    }
+    else
+    {
+        for(size_t i = 0; i < subdirs.n_offsets; i++)
+            glob_descend(walk, dirfd, path_len, &subdirs.data[subdirs.offsets[i]], segi);
+    }
+
+    free(matched.data);
+    free(matched.offsets);
+    free(subdirs.data);
+    free(subdirs.offsets);
+}
+
+/**
+ * @brief Compare two strings of a storage by their offsets (qsort_r comparator).
+ */
+int compare_storage_strings(const void *a, const void *b, void *data)
+{
+    return strcmp((char*)data + *(size_t*)a, (char*)data + *(size_t*)b);
+}
+
+/**
+ * @brief Append the paths that match a glob pattern to a storage, sorted.
+ * @param pattern   Pointer to the compiled pattern.
+ * @param storage   Pointer to the storage.
+ * @return Number of matched paths.
+ */
+size_t glob_paths(struct glob_pattern *pattern, arg_storage_t *storage)
+{
+    assert(pattern != NULL);
+    assert(storage != NULL);
+
+    if(pattern->n_segments == 0) return 0; //'/' has nothing to match
+
+    int fd = open(pattern->absolute ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1) return 0;
+
+    glob_walk_t *walk = (glob_walk_t*)calloc(1, sizeof(glob_walk_t));
+    assert(walk != NULL);
+
+    walk->pattern = pattern;
+    walk->storage = storage;
+    walk->parallel = 1;
+    walk->dents = (char*)malloc(GLOB_DENTS_BUFFER_SIZE);
+    assert(walk->dents != NULL);
+
+    if(pattern->absolute) walk->path[0] = '/';
+
+    size_t first = storage->n_offsets;
+    glob_scan(walk, fd, pattern->absolute ? 1 : 0, 0);
+
+    free(walk->dents);
+    free(walk);
+    close(fd);
+
+    size_t n_matches = storage->n_offsets - first;
+    if(n_matches > 1) //(without matches, the offsets can still be NULL)
+        qsort_r(&storage->offsets[first], n_matches, sizeof(size_t), compare_storage_strings, storage->data);
+
+    return n_matches;
+}
+
+/**
+ * @brief Expand a glob token of the cmd_line into its storage (compiling the pattern on the first run).
+ * @param cmd_line  Pointer to the working cmd_line_t struct buffer.
+ * @param tokeni    Index of the token.
+ * @return Number of matched paths (0 if the token must be kept as typed).
+ */
+int expand_glob_token(cmd_line_t *cmd_line, size_t tokeni)
+{
+    assert(cmd_line != NULL);
+    assert(tokeni < cmd_line->n_tokens);
+
+    if(cmd_line->patterns[tokeni] == NULL)
+        cmd_line->patterns[tokeni] = compile_glob_pattern(cmd_line->tokens[tokeni]);
+
+    return glob_paths(cmd_line->patterns[tokeni], &cmd_line->storage);
+}
+
+// ====================================================
+// =============== STATE IMAGE FEATURES ===============
+// ====================================================
+
+/*
+ * 'save' writes the variables and the working directory into a binary image without pointers:
+ * the nodes of the variables tree in breadth-first order (the children of each node are contiguous,
+ * so a node only keeps the index of its first child and a bitmask of their letters), followed by the
+ * null-terminated strings. 'load' maps the image read-only and does not build anything: a variable of
+ * the image is looked up in the mapping the first time it is used, and its content points into the image
+ * (no copy). That first use creates a single detached node, kept in a table indexed by the image node,
+ * instead of the path of tree nodes down to the name; the node is linked into the tree only when the tree
+ * needs it (a new variable below it, or a walk of the whole tree). Only the variables that already have
+ * nodes and the exported ones (which must be in the environment of the programs) are merged at once.
+ * An assignment gives the variable its own heap content, leaving the image untouched (copy-on-write per
+ * variable), and an image is unmapped when no variable points into it and it is not looked up anymore.
+ */
+
+#define IMAGE_MAGIC "SSHIMG01" //First bytes of a state image
+#define IMAGE_CHILDREN_MASK ((1u << ALPHABETICAL_TREE_ENTRIES) - 1) //Letters of the children of an image node
+#define IMAGE_NODE_EXPORTS (1u << 31) //Flag of the image nodes with exported variables at or below them
+
+/**
+ * @brief Header of a state image (all offsets are from the beginning of the file).
+ * @param magic           IMAGE_MAGIC.
+ * @param size            Size of the image.
+ * @param n_nodes         Number of nodes (the node 0 is the header of the tree).
+ * @param nodes_offset    Offset of the nodes array.
+ * @param cwd_offset      Offset of the working directory path.
+ * @param strings_offset  Offset of the strings area (until the end of the image).
+ */
+typedef struct
+{
+    char magic[8];
+    uint64_t size;
+    uint64_t n_nodes;
+    uint64_t nodes_offset;
+    uint64_t cwd_offset;
+    uint64_t strings_offset;
+} image_header_t;
+
+/**
+ * @brief Node of the variables tree in a state image.
+ * @param text         Offset of the content of the variable (0 if the node has no content).
+ * @param env_name     Offset of the environment name of an exported variable (0 if it is not exported).
+ * @param first_child  Index of the child with the lowest letter.
+ * @param children     Bitmask of the letters of the children (bit 0 is 'a'), and IMAGE_NODE_EXPORTS.
+ */
+typedef struct
+{
+    uint64_t text;
+    uint64_t env_name;
+    uint32_t first_child;
+    uint32_t children;
+} image_node_t;
+
+/**
+ * @brief Mapped state image.
+ * @param data      Mapping of the image.
+ * @param size      Size of the mapping.
+ * @param refs      Number of variables whose contents point into the mapping (plus one while it is looked up).
+ * @param lazy      1 (true) while the variables missing in the tree are looked up in the image. Otherwise, 0 (false).
+ * @param detached  For each image node, 1 + the index of its detached variable, or 0 (NULL until the first one).
+ */
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t refs;
+    int lazy;
+    size_t *detached;
+} state_image_t;
+
+/**
+ * @brief Variable of an image used before it has a node in the tree.
+ * @param node    Node of the variable (not linked into the tree).
+ * @param image   Pointer to the image that has the variable.
+ * @param index   Index of the image node of the variable.
+ * @param name    Name of the variable.
+ */
+typedef struct
+{
+    alphabetical_tree_node_t *node;
+    state_image_t *image;
+    size_t index;
+    char *name;
+} detached_variable_t;
+
+state_image_t **images = NULL; //mapped state images (in loading order)
+size_t n_images = 0, cap_images = 0; //number of images and capacity of 'images'
+
+detached_variable_t *detached = NULL; //variables of the images without nodes in the tree
+size_t n_detached = 0, cap_detached = 0; //number of detached variables and capacity of 'detached'
+
+/**
+ * @brief Drop a reference to a mapped image, unmapping it after the last one.
+ * @param i   Index of the image.
+ */
+void unref_state_image(size_t i)
+{
+    if(--images[i]->refs > 0) return;
+
+    munmap(images[i]->data, images[i]->size);
+    free(images[i]->detached);
+    free(images[i]);
+
+    memmove(&images[i], &images[i+1], (n_images - i - 1) * sizeof(state_image_t*)); //keep the loading order
+    n_images--;
+}
+
+/**
+ * @brief Discard the content of a variable: free it, or release its reference to a mapped image.
+ * @param text  Content of the variable.
+ */
+void release_variable_text(char *text)
+{
+    for(size_t i = 0; i < n_images; i++)
+    {
+        if(text >= images[i]->data && text < images[i]->data + images[i]->size)
+        {
+            unref_state_image(i);
+            return;
+        }
+    }
+
+    free(text);
+}
+
+/**
+ * @brief Get the nodes array of a mapped image.
+ */
+image_node_t *image_nodes(state_image_t *image)
+{
+    return (image_node_t*)(image->data + ((image_header_t*)image->data)->nodes_offset);
+}
+
+/**
+ * @brief Get the index of the child of an image node for a letter.
+ * @return The index, or 0 if the node has no child for the letter.
+ */
+size_t image_child(image_node_t *node, int letter)
+{
+    if(!(node->children & (1u << letter))) return 0;
+
+    //the children are stored in letter order
+    return node->first_child + __builtin_popcount(node->children & IMAGE_CHILDREN_MASK & ((1u << letter) - 1));
+}
+
+/**
+ * @brief Find the image node of a name (or of its first 'len' chars).
+ * @return Index of the node, or 0 if the image has no node for the name.
+ */
+size_t image_lookup(state_image_t *image, char *name, size_t len)
+{
+    image_node_t *nodes = image_nodes(image);
+    size_t index = 0;
+
+    for(size_t i = 0; i < len && (i == 0 || index != 0); i++)
+        index = image_child(&nodes[index], name[i] - 'a');
+
+    return index;
+}
+
+/**
+ * @brief Make a variable point to its content in a mapped image.
+ * @param slot    Pointer to the variable's node.
+ * @param image   Pointer to the image.
+ * @param node    Pointer to the image node of the variable.
+ */
+void share_image_text(alphabetical_tree_node_t *slot, state_image_t *image, image_node_t *node)
+{
+    if(slot->text != NULL) release_variable_text(slot->text);
+
+    slot->text = image->data + node->text;
+    slot->value.type = VALUE_TEXT; //images keep the numbers as texts
+    slot->text_stale = 0;
+    image->refs++;
+
+    if(slot->env_name == NULL && node->env_name != 0) //exported in the image
+    {
+        slot->env_name = strdup(image->data + node->env_name);
+        assert(slot->env_name != NULL);
+    }
+
+    if(slot->env_name != NULL) update_env_entry(slot);
+}
+
+/**
+ * @brief Record a detached variable in the table of its image.
+ * @param i   Index of the detached variable.
+ */
+void index_detached_variable(size_t i)
+{
+    state_image_t *image = detached[i].image;
+
+    if(image->detached == NULL) //one entry per node, zeroed pages until they are used
+    {
+        image->detached = (size_t*)calloc(((image_header_t*)image->data)->n_nodes, sizeof(size_t));
+        assert(image->detached != NULL);
+    }
+
+    image->detached[detached[i].index] = i + 1;
+}
+
+/**
+ * @brief Give a variable of an image a node of its own, without the tree nodes down to its name.
+ * @param image   Pointer to the image.
+ * @param index   Index of the image node of the variable.
+ * @param name    Name of the variable.
+ * @return Pointer to the variable's node.
+ */
+alphabetical_tree_node_t *detach_image_variable(state_image_t *image, size_t index, char *name)
+{
+    alphabetical_tree_node_t *slot = create_alphabetical_tree_node();
+    share_image_text(slot, image, &image_nodes(image)[index]);
+
+    grow_array((void**)&detached, &cap_detached, n_detached, sizeof(detached_variable_t));
+    detached[n_detached] = (detached_variable_t){slot, image, index, strdup(name)};
+    assert(detached[n_detached].name != NULL);
+    index_detached_variable(n_detached++);
+
+    return slot;
+}
+
+/**
+ * @brief Get the node of a variable for a new tree node: its detached node if it has one, or a new node.
+ * @param name  Name (or prefix of a name) of the tree node.
+ * @param len   Length of the name.
+ * @return Pointer to the node, which the caller links into the tree.
+ */
+alphabetical_tree_node_t *create_variable_node(char *name, size_t len)
+{
+    for(size_t i = 0; i < n_images && n_detached > 0; i++)
+    {
+        if(images[i]->detached == NULL) continue;
+
+        size_t index = image_lookup(images[i], name, len);
+        size_t d = index == 0 ? 0 : images[i]->detached[index];
+        if(d == 0) continue;
+
+        //the node is attached: the last detached variable takes its place in the array
+        alphabetical_tree_node_t *slot = detached[d-1].node;
+
+        images[i]->detached[index] = 0;
+        free(detached[d-1].name);
+
+        if(d != n_detached)
+        {
+            detached[d-1] = detached[n_detached-1];
+            index_detached_variable(d-1);
+        }
+
+        n_detached--;
+        return slot;
+    }
+
+    return create_alphabetical_tree_node();
+}
+
+/**
+ * @brief Add the node of a variable to the tree (with the nodes down to its name), attaching detached nodes.
+ * @param name  Lowercase name of the variable.
+ * @return Pointer to the variable's node.
+ */
+alphabetical_tree_node_t *insert_variable_node(char *name)
+{
+    alphabetical_tree_node_t **next = variables->entries, *slot = NULL;
+
+    for(size_t i = 0; name[i] != '\0'; i++)
+    {
+        int j = name[i] - 'a';
+
+        if(next[j] == NULL) next[j] = create_variable_node(name, i + 1);
+
+        slot = next[j];
+        next = slot->next;
+    }
+
+    return slot;
+}
+
+/**
+ * @brief Find a variable in the tree or, if it has no content there, in the loaded images (the newest first).
+ *        A variable found in an image gets a detached node pointing to its content in the image.
+ * @param name  Lowercase name of the variable.
+ * @return Pointer to the variable's node, or NULL if it does not exist.
+ */
+alphabetical_tree_node_t *find_variable(char *name)
+{
+    assert(variables != NULL);
+    assert(name != NULL);
+
+    alphabetical_tree_node_t *slot = find_token_in_tree(variables, name);
+
+    if(slot != NULL && slot->text != NULL) return slot;
+
+    size_t len = strlen(name);
+
+    for(size_t i = n_images; i-- > 0;)
+    {
+        if(!images[i]->lazy) continue;
+
+        size_t index = image_lookup(images[i], name, len);
+        if(index == 0) continue;
+
+        if(images[i]->detached != NULL && images[i]->detached[index] != 0) //used before
+            return detached[images[i]->detached[index] - 1].node;
+
+        if(image_nodes(images[i])[index].text == 0) continue;
+
+        if(slot != NULL) //a tree node without content
+        {
+            share_image_text(slot, images[i], &image_nodes(images[i])[index]);
+            return slot;
+        }
+
+        return detach_image_variable(images[i], index, name);
+    }
+
+    return slot;
+}
+
+/**
+ * @brief Merge an image node and its children into the variables tree.
+ *        On 'load', only the nodes that already exist in the tree and the exported variables are merged,
+ *        and the image contents replace the old ones. Otherwise ('all'), every node is merged, and only the
+ *        variables without content take the image contents.
+ * @param image   Pointer to the mapped image.
+ * @param index   Index of the image node.
+ * @param slot    Tree node (NULL for the node 0, the header of the tree).
+ * @param name    Buffer with the name of the node (MAX_TOKEN_LEN chars).
+ * @param len     Length of the name.
+ * @param all     1 (true) to merge every node. Otherwise (load), 0 (false).
+ */
+void merge_image_node(state_image_t *image, size_t index, alphabetical_tree_node_t *slot, char *name, size_t len, int all)
+{
+    image_node_t *node = &image_nodes(image)[index];
+
+    if(slot != NULL && node->text != 0 && (!all || slot->text == NULL))
+        share_image_text(slot, image, node);
+
+    if(len >= MAX_TOKEN_LEN - 1) return; //longer than the names of the variables
+
+    alphabetical_tree_node_t **next = slot == NULL ? variables->entries : slot->next;
+
+    for(int j = 0; j < ALPHABETICAL_TREE_ENTRIES; j++)
+    {
+        size_t child = image_child(node, j);
+        if(child == 0) continue;
+
+        name[len] = 'a' + j;
+
+        if(next[j] == NULL) //not in the tree
+        {
+            if(!all && !(image_nodes(image)[child].children & IMAGE_NODE_EXPORTS)) continue; //looked up later
+            next[j] = create_variable_node(name, len + 1);
+        }
+
+        merge_image_node(image, child, next[j], name, len + 1, all);
+    }
+}
+
+/**
+ * @brief Give the contents of a newly loaded image to the detached variables that it has.
+ *        They move to the table of the new image, which is looked up first.
+ * @param image   Pointer to the image.
+ */
+void merge_detached_variables(state_image_t *image)
+{
+    for(size_t i = 0; i < n_detached; i++)
+    {
+        size_t index = image_lookup(image, detached[i].name, strlen(detached[i].name));
+        if(index == 0 || image_nodes(image)[index].text == 0) continue;
+
+        share_image_text(detached[i].node, image, &image_nodes(image)[index]);
+
+        detached[i].image->detached[detached[i].index] = 0;
+        detached[i].image = image;
+        detached[i].index = index;
+        index_detached_variable(i);
+    }
+}
+
+/**
+ * @brief Merge all the variables of the loaded images into the tree, and stop looking them up.
+ *        It is used before walking the whole variables tree (saving an image or completing names).
+ */
+void materialize_state_images()
+{
+    char name[MAX_TOKEN_LEN];
+
+    for(size_t i = n_images; i-- > 0;) //the newest contents first
+        if(images[i]->lazy) merge_image_node(images[i], 0, NULL, name, 0, 1);
+
+    assert(n_detached == 0); //every detached variable has been attached on the way
+
+    for(size_t i = n_images; i-- > 0;)
+    {
+        if(!images[i]->lazy) continue;
+
+        free(images[i]->detached);
+        images[i]->detached = NULL;
+        images[i]->lazy = 0;
+        unref_state_image(i);
+    }
+}
+
+/**
+ * @brief Add a string to the strings area of an image being saved.
+ * @return Offset of the string in the image.
+ */
+uint64_t add_image_string(arg_storage_t *strings, uint64_t strings_offset, char *str)
+{
+    uint64_t offset = strings_offset + strings->len;
+    append_arg_storage(strings, str, strlen(str));
+    return offset;
+}
+
+/**
+ * @brief Write the variables and the working directory to a state image file.
+ *        The image is written to a temporary file and renamed, so a loaded image is never half written.
+ * @param path  Path of the image file.
+ * @return 1 (true) on success. Otherwise (the error is printed), returns 0 (false).
+ */
+int save_state_image(char *path)
+{
+    assert(variables != NULL);
+
+    materialize_state_images(); //the image has all the variables
+
+    //breadth-first order: the children of each node are added together at the end of the queue
+    size_t n_nodes = 1, cap_nodes = 0;
+    alphabetical_tree_node_t **queue = NULL;
+
+    grow_array((void**)&queue, &cap_nodes, 0, sizeof(alphabetical_tree_node_t*));
+    queue[0] = NULL; //the header of the tree
+
+    for(size_t i = 0; i < n_nodes; i++)
+    {
+        alphabetical_tree_node_t **next = queue[i] == NULL ? variables->entries : queue[i]->next;
+
+        for(int j = 0; j < ALPHABETICAL_TREE_ENTRIES; j++)
+        {
+            if(next[j] == NULL) continue;
+
+            grow_array((void**)&queue, &cap_nodes, n_nodes, sizeof(alphabetical_tree_node_t*));
+            queue[n_nodes++] = next[j];
+        }
+    }
+
+    image_node_t *nodes = (image_node_t*)calloc(n_nodes, sizeof(image_node_t));
+    assert(nodes != NULL);
+
+    image_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.n_nodes = n_nodes;
+    header.nodes_offset = sizeof(image_header_t);
+    header.strings_offset = header.nodes_offset + n_nodes * sizeof(image_node_t);
+
+    arg_storage_t strings = {0};
+    char cwd[PATH_MAX];
+
+    if(getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+    header.cwd_offset = add_image_string(&strings, header.strings_offset, cwd);
+
+    size_t child = 1; //index of the next child in the queue
+    for(size_t i = 0; i < n_nodes; i++)
+    {
+        alphabetical_tree_node_t **next = queue[i] == NULL ? variables->entries : queue[i]->next;
+
+        if(queue[i] != NULL && queue[i]->text != NULL)
+            nodes[i].text = add_image_string(&strings, header.strings_offset, variable_text(queue[i]));
+
+        if(queue[i] != NULL && queue[i]->env_name != NULL && queue[i]->text != NULL)
+        {
+            nodes[i].env_name = add_image_string(&strings, header.strings_offset, queue[i]->env_name);
+            nodes[i].children |= IMAGE_NODE_EXPORTS;
+        }
+
+        nodes[i].first_child = child;
+        for(int j = 0; j < ALPHABETICAL_TREE_ENTRIES; j++)
+        {
+            if(next[j] == NULL) continue;
+            nodes[i].children |= 1u << j;
+            child++;
+        }
+    }
+
+    //the exported flag goes up to the root (children come after their parents)
+    for(size_t i = n_nodes; i-- > 0;)
+    {
+        size_t n_children = __builtin_popcount(nodes[i].children & IMAGE_CHILDREN_MASK);
+
+        for(size_t k = 0; k < n_children; k++)
+            nodes[i].children |= nodes[nodes[i].first_child + k].children & IMAGE_NODE_EXPORTS;
+    }
+
+    header.size = header.strings_offset + strings.len;
+
+    //write the header, the nodes and the strings with a single syscall
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    struct iovec parts[3] = {
+        {&header, sizeof(header)},
+        {nodes, n_nodes * sizeof(image_node_t)},
+        {strings.data, strings.len}
+    };
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int saved = fd != -1 && writev(fd, parts, 3) == (ssize_t)header.size;
+
+    if(fd != -1) close(fd);
+    if(saved) saved = rename(tmp_path, path) == 0;
+    if(!saved)
+    {
+        command_error("ERROR: Cannot write the image \'%s\'\n", path);
+        unlink(tmp_path);
+    }
+
+    free(queue);
+    free(nodes);
+    free(strings.data);
+    free(strings.offsets);
+
+    return saved;
+}
+
+/**
+ * @brief Check that the offsets and indexes of a mapped image stay inside it.
+ * @return 1 (true) if the image is valid. Otherwise, returns 0 (false).
+ */
+int valid_state_image(char *data, size_t size)
+{
+    image_header_t *header = (image_header_t*)data;
+
+    if(size < sizeof(image_header_t) || memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic))) return 0;
+    if(header->size != size || header->n_nodes == 0 || header->n_nodes > UINT32_MAX) return 0;
+    if(header->nodes_offset != sizeof(image_header_t)) return 0;
+    if(header->strings_offset != header->nodes_offset + header->n_nodes * sizeof(image_node_t)) return 0;
+    if(header->strings_offset >= size || data[size-1] != '\0') return 0; //every string ends inside the image
+
+    if(header->cwd_offset < header->strings_offset || header->cwd_offset >= size) return 0;
+
+    image_node_t *nodes = (image_node_t*)(data + header->nodes_offset);
+
+    for(size_t i = 0; i < header->n_nodes; i++)
+    {
+        if(nodes[i].text != 0 && (nodes[i].text < header->strings_offset || nodes[i].text >= size)) return 0;
+        if(nodes[i].env_name != 0 && (nodes[i].env_name < header->strings_offset || nodes[i].env_name >= size)) return 0;
+        if(nodes[i].children & ~(IMAGE_CHILDREN_MASK | IMAGE_NODE_EXPORTS)) return 0;
+
+        //children come after their parent (no cycles) and inside the array
+        size_t n_children = __builtin_popcount(nodes[i].children & IMAGE_CHILDREN_MASK);
+        if(n_children > 0 && (nodes[i].first_child <= i || nodes[i].first_child + n_children > header->n_nodes)) return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Map a state image and restore its variables and its working directory.
+ * @param path  Path of the image file.
+ * @return 1 (true) on success. Otherwise (the error is printed), returns 0 (false).
+ */
+int load_state_image(char *path)
+{
+    assert(variables != NULL);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if(fd == -1 || fstat(fd, &st) == -1)
+    {
+        command_error("ERROR: Cannot open the image \'%s\'\n", path);
+        if(fd != -1) close(fd);
+        return 0;
+    }
+
+    char *data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd); //the mapping keeps the file
+
+    if(data == MAP_FAILED || !valid_state_image(data, st.st_size))
+    {
+        command_error("ERROR: \'%s\' is not a valid state image\n", path);
+        if(data != MAP_FAILED) munmap(data, st.st_size);
+        return 0;
+    }
+
+    state_image_t *image = (state_image_t*)malloc(sizeof(state_image_t));
+    assert(image != NULL);
+
+    image->data = data;
+    image->size = st.st_size;
+    image->refs = 1; //held while the image is looked up
+    image->lazy = 1;
+    image->detached = NULL;
+
+    grow_array((void**)&images, &cap_images, n_images, sizeof(state_image_t*));
+    images[n_images++] = image;
+
+    char name[MAX_TOKEN_LEN];
+    merge_detached_variables(image);
+    merge_image_node(image, 0, NULL, name, 0, 0); //variables with nodes and exported variables
+
+    variables_generation++; //expanded args pointing to the old contents are stale now
+
+    char *cwd = data + ((image_header_t*)data)->cwd_offset;
+    if(cwd[0] != '\0' && chdir(cwd) == -1)
+        command_error("ERROR: Cannot change the working directory to \'%s\'\n", cwd);
+
+    return 1;
+}
+
+/**
+ * @brief Treatment function of the SAVE command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void save_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(cmd_line->nargs != 1)
+    {
+        command_error("ERROR: The save command has 1 argument\n");
+        return;
+    }
+
+    save_state_image(cmd_line->args[0]);
+}
+
+/**
+ * @brief Treatment function of the LOAD command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void load_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(cmd_line->nargs != 1)
+    {
+        command_error("ERROR: The load command has 1 argument\n");
+        return;
+    }
+
+    load_state_image(cmd_line->args[0]);
+}
+
+// ==================================================
+// =============== WARM POOL FEATURES ===============
+// ==================================================
+
+/*
+ * The WARM command keeps helper processes forked in advance for the programs that EXEC launches often.
+ * The helpers are forked by a zygote: a small process started once by executing the shell binary again
+ * (so it has none of the trees, caches and mapped files of the shell, and forks quickly). The zygote forks
+ * them with CLONE_PARENT, so they are children of the shell, which waits for them as for any program.
+ *
+ * A helper blocks on its control socket. A launch gets the socket of a ready helper from the zygote and
+ * sends it the EXEC options, the arguments, the environment, the working directory and the standard
+ * descriptors (SCM_RIGHTS); the helper applies them and calls 'execve'. The zygote forks the replacement
+ * while the program runs. A launch without a ready helper (miss) gets a helper forked at once by the zygote.
+ */
+
+#define WARM_MAX_HELPERS 16 //Maximum number of helpers of a program
+#define WARM_DEFAULT_HELPERS 2 //Helpers of a program warmed without a count
+#define WARM_ZYGOTE_NAME "small-shell-zygote" //argv[0] of a zygote process (argv[1] is its socket)
+
+#define ZYGOTE_SET 0    //set the number of helpers of a program
+#define ZYGOTE_LAUNCH 1 //take a helper of a program
+#define ZYGOTE_STATS 2  //get the number of ready helpers of a program
+
+/**
+ * @brief Helper process waiting for a launch.
+ * @param pid   Process ID of the helper (it becomes the program's process).
+ * @param sock  Zygote's end of the control socket.
+ */
+typedef struct
+{
+    pid_t pid;
+    int sock;
+} warm_helper_t;
+
+/**
+ * @brief Ready helpers of a program, kept by the zygote.
+ * @param path     Program path, as given to EXEC.
+ * @param helpers  Ready helpers.
+ * @param n_ready  Number of ready helpers.
+ * @param size     Number of helpers kept ready.
+ */
+typedef struct
+{
+    char path[PATH_MAX];
+    warm_helper_t helpers[WARM_MAX_HELPERS];
+    size_t n_ready;
+    size_t size;
+} zygote_pool_t;
+
+/**
+ * @brief Warmed program, with its launch counters (kept by the shell).
+ * @param path    Program path, as given to EXEC.
+ * @param size    Number of helpers kept ready.
+ * @param hits    Launches served by a ready helper.
+ * @param misses  Launches that found no ready helper.
+ */
+typedef struct
+{
+    char *path;
+    size_t size;
+    unsigned long hits, misses;
+} warm_program_t;
+
+/**
+ * @brief Message of the shell to the zygote.
+ * @param type   ZYGOTE_SET, ZYGOTE_LAUNCH or ZYGOTE_STATS.
+ * @param count  Number of helpers (ZYGOTE_SET).
+ * @param path   Program path.
+ */
+typedef struct
+{
+    int type;
+    size_t count;
+    char path[PATH_MAX];
+} zygote_message_t;
+
+/**
+ * @brief Reply of the zygote. The socket of the helper is attached to the replies of ZYGOTE_LAUNCH.
+ * @param pid      Process ID of the helper (ZYGOTE_LAUNCH), or -1.
+ * @param hit      1 (true) if the helper was ready. Otherwise (forked for the launch), 0 (false).
+ * @param n_ready  Number of ready helpers of the program.
+ */
+typedef struct
+{
+    pid_t pid;
+    int hit;
+    size_t n_ready;
+} zygote_reply_t;
+
+/**
+ * @brief Header of a launch request. The strings follow it: the working directory, the arguments and the
+ *        environment entries, each one null-terminated.
+ * @param options  Options of the EXEC command.
+ * @param argc     Number of arguments.
+ * @param envc     Number of environment entries.
+ * @param len      Length of the strings.
+ */
+typedef struct
+{
+    exec_options_t options;
+    size_t argc;
+    size_t envc;
+    size_t len;
+} warm_request_t;
+
+warm_program_t *warm_programs = NULL; //warmed programs
+size_t n_warm_programs = 0, cap_warm_programs = 0; //number of warmed programs and capacity of the array
+int warm_zygote_sock = -1; //shell's end of the zygote socket (-1 if the zygote is not running)
+pid_t warm_zygote_pid = -1; //process ID of the zygote
+
+/**
+ * @brief Read exactly 'len' bytes of a descriptor.
+ * @return 1 (true) on success. Otherwise (end of file or error), returns 0 (false).
+ */
+int read_full(int fd, void *buffer, size_t len)
+{
+    size_t done = 0;
+
+    while(done < len)
+    {
+        ssize_t n_read = read(fd, (char*)buffer + done, len - done);
+
+        if(n_read == -1 && errno == EINTR) continue;
+        if(n_read <= 0) return 0;
+
+        done += n_read;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Send buffers with descriptors attached (SCM_RIGHTS) through a unix socket, without SIGPIPE.
+ * @param sock    Socket.
+ * @param iov     Buffers.
+ * @param iovcnt  Number of buffers.
+ * @param fds     Descriptors.
+ * @param n_fds   Number of descriptors (1 to 3).
+ * @return Number of bytes sent, or -1 on errors.
+ */
+ssize_t send_fds(int sock, struct iovec *iov, int iovcnt, int *fds, int n_fds)
+{
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+
+    ssize_t n_sent;
+    do n_sent = sendmsg(sock, &msg, MSG_NOSIGNAL); while(n_sent == -1 && errno == EINTR);
+
+    return n_sent;
+}
+
+/**
+ * @brief Receive a buffer through a unix socket, with the descriptors attached to it (close-on-exec).
+ * @param sock    Socket.
+ * @param buffer  Buffer.
+ * @param len     Length of the buffer (all of it is received).
+ * @param fds     Array where the descriptors will be stored (-1 for missing descriptors).
+ * @param n_fds   Number of descriptors (1 to 3).
+ * @return 1 (true) on success. Otherwise, returns 0 (false).
+ */
+int recv_fds(int sock, void *buffer, size_t len, int *fds, int n_fds)
+{
+    char control[CMSG_SPACE(3 * sizeof(int))];
+
+    struct iovec iov = {buffer, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+
+    ssize_t n_read;
+    do n_read = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC); while(n_read == -1 && errno == EINTR);
+
+    for(int i = 0; i < n_fds; i++) fds[i] = -1;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(fds, CMSG_DATA(cmsg), cmsg->cmsg_len - CMSG_LEN(0));
+
+    return n_read == (ssize_t)len;
+}
+
+/**
+ * @brief Main function of a helper process: wait for a launch request and execute its program.
+ *        This function never returns.
+ * @param sock       Helper's end of the control socket.
+ * @param shell_pid  Process ID of the shell (the parent of the helper).
+ */
+void warm_helper(int sock, pid_t shell_pid)
+{
+    prctl(PR_SET_PDEATHSIG, SIGKILL); //the waiting helpers die with the shell
+    if(getppid() != shell_pid) _exit(EXIT_FAILURE);
+
+    //a waiting helper must not keep the descriptors of the zygote (the sockets of the other helpers)
+    if(sock > 3) syscall(SYS_close_range, 3, sock - 1, 0);
+    syscall(SYS_close_range, sock + 1, ~0U, 0);
+
+    warm_request_t request;
+    int std_fds[3];
+
+    if(!recv_fds(sock, &request, sizeof(request), std_fds, 3) || std_fds[2] == -1)
+        _exit(EXIT_FAILURE); //no request: the pool has been made smaller
+
+    char *strings = (char*)malloc(request.len);
+    char **argv = (char**)calloc(request.argc+1, sizeof(char*));
+    char **envp = (char**)calloc(request.envc+1, sizeof(char*));
+    assert(strings != NULL && argv != NULL && envp != NULL);
+
+    if(!read_full(sock, strings, request.len)) _exit(EXIT_FAILURE);
+    close(sock);
+
+    char *cwd = strings;
+    char *next = cwd + strlen(cwd) + 1;
+
+    for(size_t i = 0; i < request.argc; i++, next += strlen(next) + 1)
+        argv[i] = next;
+
+    for(size_t i = 0; i < request.envc; i++, next += strlen(next) + 1)
+        envp[i] = next;
+
+    prctl(PR_SET_PDEATHSIG, 0); //the program does not die with the shell
+
+    //the received descriptors are closed by 'execve' (close-on-exec), their copies are not
+    for(int fd = 0; fd < 3; fd++)
+    {
+        if(std_fds[fd] != fd) dup2(std_fds[fd], fd);
+        else fcntl(fd, F_SETFD, 0);
+    }
+
+    if(chdir(cwd) == -1 || !apply_exec_options(&request.options))
+    {
+        fflush(stdout);
+        _exit(EXIT_FAILURE);
+    }
+
+    execve(argv[0], argv, envp);
+
+    //execve only returns on errors
+    command_error("ERROR: Cannot execute \'%s\'\n", argv[0]);
+    fflush(stdout);
+    _exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Fork a ready helper of a pool (in the zygote). The helper is a child of the shell (CLONE_PARENT).
+ * @return 1 (true) on success. Otherwise, returns 0 (false).
+ */
+int spawn_warm_helper(zygote_pool_t *pool, pid_t shell_pid)
+{
+    int socks[2];
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks) == -1) return 0;
+
+    pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0); //fork as a sibling
+
+    if(pid == -1)
+    {
+        close(socks[0]);
+        close(socks[1]);
+        return 0;
+    }
+
+    if(pid == 0) //helper
+    {
+        close(socks[0]);
+        warm_helper(socks[1], shell_pid);
+    }
+
+    close(socks[1]);
+
+    pool->helpers[pool->n_ready].pid = pid;
+    pool->helpers[pool->n_ready].sock = socks[0];
+    pool->n_ready++;
+
+    return 1;
+}
+
+/**
+ * @brief Main function of the zygote process: serve the messages of the shell until it closes the socket.
+ *        This function never returns.
+ * @param sock  Zygote's end of the socket.
+ */
+void warm_zygote(int sock)
+{
+    pid_t shell_pid = getppid();
+    zygote_pool_t *pools = NULL;
+    size_t n_pools = 0, cap_pools = 0;
+    zygote_message_t message;
+
+    while(read_full(sock, &message, sizeof(message)))
+    {
+        message.path[PATH_MAX-1] = '\0';
+
+        zygote_pool_t *pool = NULL;
+        for(size_t i = 0; i < n_pools && pool == NULL; i++)
+            if(!strcmp(pools[i].path, message.path)) pool = &pools[i];
+
+        if(pool == NULL)
+        {
+            grow_array((void**)&pools, &cap_pools, n_pools, sizeof(zygote_pool_t));
+            pool = &pools[n_pools++];
+            memset(pool, 0, sizeof(zygote_pool_t));
+            strcpy(pool->path, message.path);
+        }
+
+        zygote_reply_t reply = {-1, 0, 0};
+        int helper_sock = -1;
+
+        if(message.type == ZYGOTE_SET)
+        {
+            pool->size = message.count <= WARM_MAX_HELPERS ? message.count : WARM_MAX_HELPERS;
+
+            while(pool->n_ready > pool->size) //the helper exits when its socket is closed
+                close(pool->helpers[--pool->n_ready].sock);
+
+            while(pool->n_ready < pool->size && spawn_warm_helper(pool, shell_pid));
+        }
+        else if(message.type == ZYGOTE_LAUNCH)
+        {
+            reply.hit = pool->n_ready > 0;
+
+            if(reply.hit || spawn_warm_helper(pool, shell_pid))
+            {
+                warm_helper_t *helper = &pool->helpers[--pool->n_ready];
+                reply.pid = helper->pid;
+                helper_sock = helper->sock;
+            }
+        }
+
+        reply.n_ready = pool->n_ready;
+
+        struct iovec iov = {&reply, sizeof(reply)};
+        ssize_t n_sent;
+
+        if(helper_sock != -1)
+        {
+            n_sent = send_fds(sock, &iov, 1, &helper_sock, 1);
+            close(helper_sock);
+        }
+        else do n_sent = send(sock, &reply, sizeof(reply), MSG_NOSIGNAL); while(n_sent == -1 && errno == EINTR);
+
+        if(n_sent != sizeof(reply)) break;
+
+        //the replacement is forked while the program runs
+        while(pool->n_ready < pool->size && spawn_warm_helper(pool, shell_pid));
+    }
+
+    _exit(EXIT_SUCCESS); //the waiting helpers see the end of their sockets and exit
+}
+
+/**
+ * @brief Become the zygote if this process has been executed as one (by start_warm_zygote), i.e. with the
+ *        arguments 'small-shell-zygote' and the descriptor of an open socket. It must be called at the beginning
+ *        of the main function.
+ */
+void check_warm_zygote(int argc, char **argv)
+{
+    if(argc != 2 || strcmp(argv[0], WARM_ZYGOTE_NAME)) return;
+
+    char *end;
+    long sock = strtol(argv[1], &end, 10);
+
+    if(end == argv[1] || *end != '\0' || sock < 0 || sock > INT_MAX) return;
+    if(fcntl((int)sock, F_GETFD) == -1) return; //not an open descriptor
+
+    warm_zygote((int)sock);
+}
+
+/**
+ * @brief Start the zygote: fork and execute the shell binary again, with the socket in its arguments.
+ * @return 1 (true) on success. Otherwise, returns 0 (false).
+ */
+int start_warm_zygote()
+{
+    int socks[2];
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks) == -1) return 0;
+
+    fflush(stdout); //the child must not inherit pending output
+
+    pid_t pid = fork();
+
+    if(pid == -1)
+    {
+        close(socks[0]);
+        close(socks[1]);
+        return 0;
+    }
+
+    if(pid == 0)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGKILL); //the zygote dies with the shell
+        fcntl(socks[1], F_SETFD, 0); //kept by 'execve'
+
+        char sock[32];
+        sprintf(sock, "%d", socks[1]);
+
+        char *argv[] = {WARM_ZYGOTE_NAME, sock, NULL};
+        char *envp[] = {NULL};
+
+        execve("/proc/self/exe", argv, envp);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(socks[1]);
+
+    warm_zygote_sock = socks[0];
+    warm_zygote_pid = pid;
+
+    return 1;
+}
+
+/**
+ * @brief Wait for the helpers that have exited (e.g. after the pool was made smaller) and for a dead zygote.
+ *        The shell has no other child processes between its commands.
+ */
+void reap_warm_helpers()
+{
+    pid_t pid;
+
+    while((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+    {
+        if(pid == warm_zygote_pid) warm_zygote_pid = -1;
+    }
+}
+
+/**
+ * @brief Send a message to the zygote and receive its reply (starting the zygote if it is not running).
+ * @param message      Pointer to the message.
+ * @param reply        Pointer to where the reply will be stored.
+ * @param helper_sock  Pointer to where the socket of the helper will be stored (ZYGOTE_LAUNCH), or NULL.
+ * @return 1 (true) on success. Otherwise (the zygote is stopped), returns 0 (false).
+ */
+int call_warm_zygote(zygote_message_t *message, zygote_reply_t *reply, int *helper_sock)
+{
+    if(warm_zygote_sock == -1 && !start_warm_zygote()) return 0;
+
+    int fd = -1;
+    ssize_t n_sent;
+    do n_sent = send(warm_zygote_sock, message, sizeof(*message), MSG_NOSIGNAL); while(n_sent == -1 && errno == EINTR);
+
+    if(n_sent != sizeof(*message) || !recv_fds(warm_zygote_sock, reply, sizeof(*reply), &fd, 1))
+    {
+        if(fd != -1) close(fd);
+
+        close(warm_zygote_sock); //a new zygote will be started
+        warm_zygote_sock = -1;
+        if(warm_zygote_pid != -1) kill(warm_zygote_pid, SIGKILL);
+        return 0;
+    }
+
+    if(helper_sock != NULL) *helper_sock = fd;
+    else if(fd != -1) close(fd);
+
+    return 1;
+}
+
+/**
+ * @brief Find a warmed program by its path.
+ * @return Pointer to the program, or NULL if the path has not been warmed.
+ */
+warm_program_t *find_warm_program(char *path)
+{
+    for(size_t i = 0; i < n_warm_programs; i++)
+        if(!strcmp(warm_programs[i].path, path)) return &warm_programs[i];
+
+    return NULL;
+}
+
+/**
+ * @brief Send a launch request with the standard descriptors to a helper.
+ * @return 1 (true) on success. Otherwise (e.g. the helper is dead), returns 0 (false).
+ */
+int send_warm_request(int sock, warm_request_t *request, char *strings, int *std_fds)
+{
+    struct iovec iov[2] = {{request, sizeof(*request)}, {strings, request->len}};
+    ssize_t n_sent = send_fds(sock, iov, 2, std_fds, 3);
+
+    if(n_sent < (ssize_t)sizeof(*request)) return 0;
+
+    //the rest of a long request (bigger than the socket buffer)
+    size_t done = n_sent - sizeof(*request);
+    while(done < request->len)
+    {
+        n_sent = send(sock, strings + done, request->len - done, MSG_NOSIGNAL);
+
+        if(n_sent == -1 && errno == EINTR) continue;
+        if(n_sent <= 0) return 0;
+
+        done += n_sent;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Launch a program of the EXEC command through a helper, if the program has been warmed.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the options, the path and the arguments.
+ * @param options   Pointer to the parsed options of the EXEC command.
+ * @param std_fds   Descriptors of the program's stdin, stdout and stderr (before its redirections).
+ * @param pid       Pointer to where the process ID of the program will be stored.
+ * @return 1 (true) if the program has been launched, 0 (false) if it must be forked as usual,
+ *         or -1 on errors (reported).
+ */
+int warm_launch(cmd_line_t *cmd_line, exec_options_t *options, int *std_fds, pid_t *pid)
+{
+    warm_program_t *program = find_warm_program(cmd_line->args[options->first]);
+    if(program == NULL) return 0;
+
+    reap_warm_helpers();
+
+    //the shell opens the redirections and sends the descriptors
+    int fds[3] = {std_fds[0], std_fds[1], std_fds[2]};
+    int opened[cmd_line->n_redirects + 1];
+
+    if(cmd_line->n_redirects > 0 && !open_redirections(cmd_line, opened)) return -1;
+
+    for(size_t i = 0; i < cmd_line->n_redirects; i++)
+        fds[cmd_line->redirects[i].fd] = opened[i] != -1 ? opened[i] : fds[STDOUT_FILENO]; //-1 for '2>&1'
+
+    zygote_message_t message;
+    zygote_reply_t reply;
+    int helper_sock = -1, launched = 0;
+
+    memset(&message, 0, sizeof(message));
+    message.type = ZYGOTE_LAUNCH;
+    strncpy(message.path, program->path, PATH_MAX-1);
+
+    if(call_warm_zygote(&message, &reply, &helper_sock) && helper_sock != -1)
+    {
+        char cwd[PATH_MAX];
+        if(getcwd(cwd, sizeof(cwd)) == NULL) strcpy(cwd, ".");
+
+        warm_request_t request;
+        request.options = *options;
+        request.argc = cmd_line->nargs - options->first;
+        request.envc = n_envp;
+        request.len = strlen(cwd) + 1;
+
+        //the helper was forked from the zygote: it gets the current CPUs of the shell
+        if(!request.options.has_cpus && sched_getaffinity(0, sizeof(cpu_set_t), &request.options.cpus) == 0)
+            request.options.has_cpus = 1;
+
+        for(size_t i = 0; i < request.argc; i++)
+            request.len += strlen(cmd_line->args[options->first + i]) + 1;
+        for(size_t i = 0; i < n_envp; i++)
+            request.len += strlen(shell_envp[i]) + 1;
+
+        char *strings = (char*)malloc(request.len);
+        assert(strings != NULL);
+
+        char *next = stpcpy(strings, cwd) + 1;
+        for(size_t i = 0; i < request.argc; i++)
+            next = stpcpy(next, cmd_line->args[options->first + i]) + 1;
+        for(size_t i = 0; i < n_envp; i++)
+            next = stpcpy(next, shell_envp[i]) + 1;
+
+        launched = send_warm_request(helper_sock, &request, strings, fds);
+
+        free(strings);
+        close(helper_sock);
+
+        if(!launched) //dead helper: fork as usual
+        {
+            kill(reply.pid, SIGKILL);
+            while(waitpid(reply.pid, NULL, 0) == -1 && errno == EINTR);
+        }
+    }
+
+    for(size_t i = 0; i < cmd_line->n_redirects; i++)
+        if(opened[i] != -1) close(opened[i]);
+
+    if(launched && reply.hit) program->hits++;
+    else program->misses++;
+
+    *pid = reply.pid;
+    return launched;
+}
+
+/**
+ * @brief Treatment function of the WARM command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void warm_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    zygote_message_t message;
+    zygote_reply_t reply;
+    memset(&message, 0, sizeof(message));
+
+    reap_warm_helpers();
+
+    if(cmd_line->nargs == 0) //print the pool
+    {
+        printf("%-40s %7s %10s %10s %9s\n", "PROGRAM", "READY", "HITS", "MISSES", "HIT RATE");
+
+        for(size_t i = 0; i < n_warm_programs; i++)
+        {
+            warm_program_t *program = &warm_programs[i];
+            unsigned long launches = program->hits + program->misses;
+
+            message.type = ZYGOTE_STATS;
+            strncpy(message.path, program->path, PATH_MAX-1);
+            if(!call_warm_zygote(&message, &reply, NULL)) reply.n_ready = 0;
+
+            printf("%-40s %3zu/%-3zu %10lu %10lu %8.1f%%\n", program->path, reply.n_ready, program->size,
+                   program->hits, program->misses, launches > 0 ? 100.0 * program->hits / launches : 0.0);
+        }
+        return;
+    }
+
+    char *end = NULL;
+    unsigned long size = WARM_DEFAULT_HELPERS;
+
+    if(cmd_line->nargs == 2) size = strtoul(cmd_line->args[1], &end, 10);
+
+    if(cmd_line->nargs > 2 || (end != NULL && (*end != '\0' || end == cmd_line->args[1] || size > WARM_MAX_HELPERS)))
+    {
+        command_error("ERROR: The warm syntax is: warm [path] [count (0 to %d)]\n", WARM_MAX_HELPERS);
+        return;
+    }
+
+    char *path = cmd_line->args[0];
+    warm_program_t *program = find_warm_program(path);
+
+    if(strlen(path) >= PATH_MAX || (size > 0 && access(path, X_OK) == -1))
+    {
+        command_error("ERROR: \'%s\' is not an executable file\n", path);
+        return;
+    }
+
+    if(program == NULL && size == 0)
+    {
+        command_error("ERROR: \'%s\' has not been warmed\n", path);
+        return;
+    }
+
+    message.type = ZYGOTE_SET;
+    message.count = size;
+    strcpy(message.path, path);
+
+    if(!call_warm_zygote(&message, &reply, NULL) || reply.n_ready < size)
+    {
+        command_error("ERROR: Cannot create the helper processes\n");
+        return;
+    }
+
+    if(program == NULL)
+    {
+        grow_array((void**)&warm_programs, &cap_warm_programs, n_warm_programs, sizeof(warm_program_t));
+        program = &warm_programs[n_warm_programs++];
+        memset(program, 0, sizeof(warm_program_t));
+
+        program->path = strdup(path);
+        assert(program->path != NULL);
+    }
+
+    program->size = size;
+
+    if(size == 0) //the program is not warmed anymore
+    {
+        free(program->path);
+        *program = warm_programs[--n_warm_programs];
+    }
+}
+
+// ========================================================
+// =============== DIRECTORY CACHE FEATURES ===============
+// ========================================================
+
+/*
+ * The entries of a directory are read once (getdents64) and kept in memory, keyed by the inode of
+ * the directory. An inotify watch on each cached directory reports its changes, which are applied
+ * to the cache as deltas (added and removed entries), so the directory is not read again. The path
+ * completion always uses the cache; the LS command uses it when 'lscache on' has been typed, and then
+ * prints a listing rendered once. The least recently used directories are dropped when the cache
+ * exceeds DIR_CACHE_MAX_BYTES.
+ */
+
+#define DENTS64_BUFFER_SIZE (1024*1024) //Buffer size for each 'getdents64' syscall
+#define DIR_CACHE_MAX_BYTES (64*1024*1024) //Memory limit of the directory cache
+
+/**
+ * @brief Cached entries of a directory.
+ * @param dev           Device of the directory.
+ * @param ino           Inode of the directory.
+ * @param path          Path of the directory (used to watch it and to read it again).
+ * @param wd            inotify watch descriptor (-1 if the directory is not watched).
+ * @param valid         1 (true) if the entries are up to date. Otherwise (lost events), 0 (false).
+ * @param names         Arena with the null-terminated names of the entries.
+ * @param names_len     Used bytes of the arena.
+ * @param names_cap     Capacity of the arena.
+ * @param dead_bytes    Bytes of the arena used by removed entries.
+ * @param name_offsets  Offset of each entry's name in the arena.
+ * @param types         d_type of each entry.
+ * @param n_entries     Number of entries (removed entries included).
+ * @param cap_entries   Capacity of the entry arrays.
+ * @param sorted        Indexes of the current entries sorted by name (for prefix searches and listings).
+ * @param n_sorted      Number of current entries.
+ * @param listing       Rendered LS listing (NULL if it must be rendered again).
+ * @param listing_len   Length of the listing.
+ * @param prev          Previous directory in the LRU list (more recently used).
+ * @param next          Next directory in the LRU list (less recently used).
+ */
+typedef struct dir_cache
+{
+    dev_t dev;
+    ino_t ino;
+    char *path;
+    int wd;
+    int valid;
+
+    char *names;
+    size_t names_len, names_cap, dead_bytes;
+
+    size_t *name_offsets;
+    unsigned char *types;
+    size_t n_entries, cap_entries;
+
+    size_t *sorted;
+    size_t n_sorted;
+
+    char *listing;
+    size_t listing_len;
+
+    struct dir_cache *prev, *next;
+} dir_cache_t;
+
+dir_cache_t *dir_caches = NULL; //LRU list of cached directories (most recently used first)
+dir_cache_t *dir_caches_tail = NULL; //least recently used directory
+size_t dir_cache_bytes = 0; //memory used by the cached directories
+int dir_cache_inotify_fd = -1; //inotify descriptor of the directory cache
+int ls_cache_enabled = 0; //1 (true) if the LS command uses the cache
+size_t ls_cache_hits = 0, ls_cache_misses = 0; //LS listings printed from memory / read from the disk
+
+/**
+ * @brief Memory used by a cached directory.
+ */
+size_t dir_cache_size(dir_cache_t *dir)
+{
+    return sizeof(dir_cache_t) + strlen(dir->path) + dir->names_cap + dir->listing_len +
+           dir->cap_entries * (2*sizeof(size_t) + sizeof(unsigned char));
+}
+
+/**
+ * @brief Discard the entries of a cached directory (the directory stays in the LRU list).
+ */
+void clear_dir_cache(dir_cache_t *dir)
+{
+    dir_cache_bytes -= dir_cache_size(dir);
+
+    free(dir->names);
+    free(dir->name_offsets);
+    free(dir->types);
+    free(dir->sorted);
+    free(dir->listing);
+
+    dir->names = NULL;
+    dir->name_offsets = NULL;
+    dir->types = NULL;
+    dir->sorted = NULL;
+    dir->listing = NULL;
+    dir->names_len = dir->names_cap = dir->dead_bytes = 0;
+    dir->n_entries = dir->cap_entries = dir->n_sorted = 0;
+    dir->listing_len = 0;
+    dir->valid = 0;
+
+    dir_cache_bytes += dir_cache_size(dir);
+}
+
+/**
+ * @brief Remove a directory from the cache (and stop watching it).
+ */
+void drop_dir_cache(dir_cache_t *dir)
+{
+    clear_dir_cache(dir);
+    dir_cache_bytes -= dir_cache_size(dir);
+
+    if(dir->wd != -1) inotify_rm_watch(dir_cache_inotify_fd, dir->wd);
+
+    //unlink from the LRU list
+    if(dir->prev != NULL) dir->prev->next = dir->next;
+    else dir_caches = dir->next;
+
+    if(dir->next != NULL) dir->next->prev = dir->prev;
+    else dir_caches_tail = dir->prev;
+
+    free(dir->path);
+    free(dir);
+}
+
+/**
+ * @brief Move a directory to the front of the LRU list.
+ */
+void touch_dir_cache(dir_cache_t *dir)
+{
+    if(dir_caches == dir) return;
+
+    //unlink
+    dir->prev->next = dir->next;
+    if(dir->next != NULL) dir->next->prev = dir->prev;
+    else dir_caches_tail = dir->prev;
+
+    //insert at the front
+    dir->prev = NULL;
+    dir->next = dir_caches;
+    dir_caches->prev = dir;
+    dir_caches = dir;
+}
+
+/**
+ * @brief Drop the least recently used directories while the cache exceeds its memory limit.
+ * @param keep  Directory that must not be dropped (the one in use).
+ */
+void evict_dir_caches(dir_cache_t *keep)
+{
+    while(dir_cache_bytes > DIR_CACHE_MAX_BYTES && dir_caches_tail != NULL && dir_caches_tail != keep)
+        drop_dir_cache(dir_caches_tail);
+}
+
+/**
+ * @brief Get the name of an entry of a cached directory.
+ */
+char *dir_cache_name(dir_cache_t *dir, size_t entry)
+{
+    return &dir->names[dir->name_offsets[entry]];
+}
+
+/**
+ * @brief Find the first sorted entry of a cached directory whose name is not smaller than a text (binary search).
+ * @return Position in the 'sorted' array.
+ */
+size_t dir_cache_lower_bound(dir_cache_t *dir, char *text)
+{
+    size_t low = 0, high = dir->n_sorted;
+
+    while(low < high)
+    {
+        size_t middle = (low + high) / 2;
+
+        if(strcmp(dir_cache_name(dir, dir->sorted[middle]), text) < 0) low = middle + 1;
+        else high = middle;
+    }
+
+    return low;
+}
+
+/**
+ * @brief Append an entry to the arena and arrays of a cached directory (it is not added to 'sorted').
+ * @return Index of the entry.
+ */
+size_t add_dir_cache_entry(dir_cache_t *dir, char *name, unsigned char type)
+{
+    size_t len = strlen(name) + 1;
+    dir_cache_bytes -= dir_cache_size(dir);
+
+    while(dir->names_len + len > dir->names_cap)
+    {
+        dir->names_cap = dir->names_cap == 0 ? 4096 : dir->names_cap * 2;
+        dir->names = (char*)realloc(dir->names, dir->names_cap);
+        assert(dir->names != NULL);
+    }
+
+    if(dir->n_entries == dir->cap_entries)
+    {
+        dir->cap_entries = dir->cap_entries == 0 ? 256 : dir->cap_entries * 2;
+        dir->name_offsets = (size_t*)realloc(dir->name_offsets, dir->cap_entries * sizeof(size_t));
+        dir->types = (unsigned char*)realloc(dir->types, dir->cap_entries);
+        dir->sorted = (size_t*)realloc(dir->sorted, dir->cap_entries * sizeof(size_t));
+        assert(dir->name_offsets != NULL && dir->types != NULL && dir->sorted != NULL);
+    }
+
+    dir_cache_bytes += dir_cache_size(dir);
+
+    memcpy(&dir->names[dir->names_len], name, len);
+    dir->name_offsets[dir->n_entries] = dir->names_len;
+    dir->types[dir->n_entries] = type;
+    dir->names_len += len;
+
+    return dir->n_entries++;
+}
+
+/**
+ * @brief Compare two entries of a cached directory by name (qsort_r callback).
+ */
+int compare_dir_cache_entries(const void *a, const void *b, void *data)
+{
+    dir_cache_t *dir = (dir_cache_t*)data;
+
+    return strcmp(dir_cache_name(dir, *(size_t*)a), dir_cache_name(dir, *(size_t*)b));
+}
+
+/**
+ * @brief Read all entries of the directory into the cache (with a few large 'getdents64' syscalls).
+ * @return 1 (true) on success. Otherwise, returns 0 (false).
+ */
+int fill_dir_cache(dir_cache_t *dir)
+{
+    clear_dir_cache(dir);
+
+    int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1) return 0;
+
+    void *buffer = malloc(DENTS64_BUFFER_SIZE);
+    assert(buffer != NULL);
+
+    long n_read;
+    while((n_read = syscall(SYS_getdents64, fd, buffer, DENTS64_BUFFER_SIZE)) > 0)
+    {
+        for(long offset = 0; offset < n_read; offset += ((linux_dirent64_t*)(buffer + offset))->d_reclen)
+        {
+            linux_dirent64_t *entrie = (linux_dirent64_t*)(buffer + offset);
+
+            if(strcmp(entrie->d_name, ".") && strcmp(entrie->d_name, "..")) //ignore '.' and '..'
+                add_dir_cache_entry(dir, entrie->d_name, entrie->d_type);
+        }
+    }
+
+    free(buffer);
+    close(fd);
+
+    if(n_read == -1)
+    {
+        clear_dir_cache(dir);
+        return 0;
+    }
+
+    for(size_t i = 0; i < dir->n_entries; i++)
+        dir->sorted[i] = i;
+    dir->n_sorted = dir->n_entries;
+
+    if(dir->n_sorted > 1) //(an empty directory has no sorted array)
+        qsort_r(dir->sorted, dir->n_sorted, sizeof(size_t), compare_dir_cache_entries, dir);
+
+    dir->valid = 1;
+    return 1;
+}
+
+/**
+ * @brief Apply an 'entry created' event to a cached directory.
+ */
+void add_dir_cache_delta(dir_cache_t *dir, char *name, int is_dir)
+{
+    size_t pos = dir_cache_lower_bound(dir, name);
+    if(pos < dir->n_sorted && !strcmp(dir_cache_name(dir, dir->sorted[pos]), name)) return; //already cached
+
+    unsigned char type = DT_DIR;
+
+    if(!is_dir) //get the type of the new entry
+    {
+        char *path = (char*)malloc(strlen(dir->path) + strlen(name) + 2);
+        assert(path != NULL);
+        sprintf(path, "%s/%s", dir->path, name);
+
+        struct stat st;
+        if(lstat(path, &st) == -1) type = DT_UNKNOWN;
+        else if(S_ISREG(st.st_mode)) type = DT_REG;
+        else if(S_ISDIR(st.st_mode)) type = DT_DIR;
+        else if(S_ISLNK(st.st_mode)) type = DT_LNK;
+        else if(S_ISSOCK(st.st_mode)) type = DT_SOCK;
+        else if(S_ISCHR(st.st_mode)) type = DT_CHR;
+        else if(S_ISBLK(st.st_mode)) type = DT_BLK;
+        else if(S_ISFIFO(st.st_mode)) type = DT_FIFO;
+        else type = DT_UNKNOWN;
+
+        free(path);
+    }
+
+    size_t entry = add_dir_cache_entry(dir, name, type);
+
+    memmove(&dir->sorted[pos+1], &dir->sorted[pos], (dir->n_sorted - pos) * sizeof(size_t));
+    dir->sorted[pos] = entry;
+    dir->n_sorted++;
+}
+
+/**
+ * @brief Apply an 'entry removed' event to a cached directory.
+ *        The name stays in the arena; the directory is read again when half of the arena is dead.
+ */
+void remove_dir_cache_delta(dir_cache_t *dir, char *name)
+{
+    size_t pos = dir_cache_lower_bound(dir, name);
+    if(pos == dir->n_sorted || strcmp(dir_cache_name(dir, dir->sorted[pos]), name)) return; //not cached
+
+    dir->dead_bytes += strlen(name) + 1;
+
+    memmove(&dir->sorted[pos], &dir->sorted[pos+1], (dir->n_sorted - pos - 1) * sizeof(size_t));
+    dir->n_sorted--;
+
+    if(dir->dead_bytes > dir->names_len / 2) dir->valid = 0; //compact it by reading it again
+}
+
+/**
+ * @brief Read the pending inotify events and apply them to the cached directories.
+ */
+void apply_dir_cache_events()
+{
+    if(dir_cache_inotify_fd == -1) return;
+
+    char buffer[64*1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n_read;
+
+    while((n_read = read(dir_cache_inotify_fd, buffer, sizeof(buffer))) > 0) //non-blocking descriptor
+    {
+        for(char *ptr = buffer; ptr < buffer + n_read; ptr += sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len)
+        {
+            struct inotify_event *event = (struct inotify_event*)ptr;
+
+            for(dir_cache_t *dir = dir_caches; dir != NULL; dir = dir->next)
+            {
+                if(event->mask & IN_Q_OVERFLOW) //events lost: every directory must be read again
+                {
+                    dir->valid = 0;
+                    continue;
+                }
+
+                if(dir->wd != event->wd) continue;
+
+                if(event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) //the directory itself has gone
+                {
+                    dir->valid = 0;
+                    if(event->mask & IN_IGNORED) dir->wd = -1;
+                }
+                else if(dir->valid && event->len > 0)
+                {
+                    if(event->mask & (IN_CREATE | IN_MOVED_TO))
+                        add_dir_cache_delta(dir, event->name, (event->mask & IN_ISDIR) != 0);
+                    else if(event->mask & (IN_DELETE | IN_MOVED_FROM))
+                        remove_dir_cache_delta(dir, event->name);
+                }
+
+                //the rendered listing is out of date
+                dir_cache_bytes -= dir->listing_len;
+                free(dir->listing);
+                dir->listing = NULL;
+                dir->listing_len = 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Get the cached entries of a directory, reading them if the directory is not cached yet.
+ * @param path  Path of the directory.
+ * @return Pointer to the cached directory, or NULL if it cannot be read.
+ */
+dir_cache_t *get_dir_cache(char *path)
+{
+    assert(path != NULL);
+
+    if(dir_cache_inotify_fd == -1)
+        dir_cache_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    apply_dir_cache_events();
+
+    struct stat st;
+    if(stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) return NULL;
+
+    dir_cache_t *dir;
+    for(dir = dir_caches; dir != NULL; dir = dir->next)
+    {
+        if(dir->dev == st.st_dev && dir->ino == st.st_ino) break;
+    }
+
+    if(dir == NULL) //new cached directory
+    {
+        dir = (dir_cache_t*)calloc(1, sizeof(dir_cache_t));
+        assert(dir != NULL);
+
+        dir->dev = st.st_dev;
+        dir->ino = st.st_ino;
+        dir->path = strdup(path);
+        dir->wd = -1;
+
+        //insert at the front of the LRU list
+        dir->next = dir_caches;
+        if(dir_caches != NULL) dir_caches->prev = dir;
+        else dir_caches_tail = dir;
+        dir_caches = dir;
+
+        dir_cache_bytes += dir_cache_size(dir);
+    }
+    else touch_dir_cache(dir);
+
+    if(!dir->valid || dir->wd == -1) //not read yet, or changed without deltas
+    {
+        //watch before reading, so changes during the reading are not lost
+        if(dir->wd == -1 && dir_cache_inotify_fd != -1)
+        {
+            dir->wd = inotify_add_watch(dir_cache_inotify_fd, path,
+                                        IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        }
+
+        //the path can lead to other directory now (cached with its old path)
+        free(dir->path);
+        dir->path = strdup(path);
+
+        ls_cache_misses++;
+
+        if(!fill_dir_cache(dir))
+        {
+            drop_dir_cache(dir);
+            return NULL;
+        }
+    }
+    else ls_cache_hits++;
+
+    evict_dir_caches(dir);
+    return dir;
+}
+
+/**
+ * @brief Print the LS listing of a directory from the cache. The listing is rendered once and
+ *        printed with a single copy while the directory does not change.
+ * @param path  Path of the directory.
+ * @return 1 (true) on success. Otherwise, returns 0 (false).
+ */
+int print_cached_listing(char *path)
+{
+    dir_cache_t *dir = get_dir_cache(path);
+    if(dir == NULL) return 0;
+
+    if(dir->listing == NULL) //render the listing
+    {
+        FILE *out = open_memstream(&dir->listing, &dir->listing_len);
+        assert(out != NULL);
+
+        for(size_t i = 0; i < dir->n_sorted; i++)
+            print_entry(out, dir_cache_name(dir, dir->sorted[i]), dir->types[dir->sorted[i]]);
+
+        fclose(out);
+        dir_cache_bytes += dir->listing_len;
+
+        evict_dir_caches(dir);
+    }
+
+    fwrite(dir->listing, 1, dir->listing_len, stdout);
+    return 1;
+}
+
+/**
+ * @brief Treatment function of the LSCACHE command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void lscache_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(cmd_line->nargs == 0)
+    {
+        size_t n_dirs = 0;
+        for(dir_cache_t *dir = dir_caches; dir != NULL; dir = dir->next) n_dirs++;
+
+        printf("LS cache: %s\n"
+               "Cached directories: %zu (%zu KiB of %d KiB)\n"
+               "Reads from memory: %zu\n"
+               "Reads from disk: %zu\n",
+               ls_cache_enabled ? "on" : "off", n_dirs, dir_cache_bytes / 1024, DIR_CACHE_MAX_BYTES / 1024,
+               ls_cache_hits, ls_cache_misses);
+    }
+    else if(cmd_line->nargs == 1 && !strcmp(cmd_line->args[0], "on"))
+        ls_cache_enabled = 1;
+    else if(cmd_line->nargs == 1 && !strcmp(cmd_line->args[0], "off"))
+        ls_cache_enabled = 0;
+    else
+    {
+        command_error("ERROR: The lscache syntax is: lscache [on or off]\n");
+        print_cmd_line(cmd_line);
+    }
+}
+
+// =================================================================
+// =============== HISTORY AND LINE EDITING FEATURES ===============
+// =================================================================
+
+#define HISTORY_FILE_NAME ".small_shell_history" //History file in the home directory
+#define MAX_LINE_LEN (MAX_TOKEN_LEN*4) //Maximum length of a line typed in the line editor
+
+/**
+ * @brief Persistent command history.
+ *        The history file is append-only: each entry is a line, written with a single 'write' on an
+ *        O_APPEND descriptor, so concurrent shells never mix their entries. The file is memory-mapped
+ *        and indexed by the offset of each entry; the index is extended (not rebuilt) when the file grows.
+ * @param fd          History file descriptor (-1 if there is no history).
+ * @param map         Mapping of the history file.
+ * @param map_len     Length of the mapping.
+ * @param offsets     Offset of each entry in the file, plus the end of the last entry (n_entries+1 items).
+ * @param n_entries   Number of indexed entries.
+ * @param cap_offsets Capacity of the 'offsets' array.
+ */
+typedef struct
+{
+    int fd;
+    char *map;
+    size_t map_len;
+    size_t *offsets;
+    size_t n_entries;
+    size_t cap_offsets;
+} history_t;
+
+history_t history = {-1, NULL, 0, NULL, 0, 0};
+
+/**
+ * @brief Map the new part of the history file (written by this or other shells) and index its entries.
+ *        A file truncated under the mapping (e.g. cleared by hand) is mapped and indexed again.
+ */
+void refresh_history()
+{
+    if(history.fd == -1) return;
+
+    struct stat st;
+    if(fstat(history.fd, &st) == -1 || st.st_size < 0) return;
+
+    size_t size = (size_t)st.st_size;
+
+    if(size < history.map_len) //truncated: the mapped pages past the end are gone
+    {
+        munmap(history.map, history.map_len);
+        history.map = NULL;
+        history.map_len = 0;
+        history.n_entries = 0;
+    }
+
+    if(size <= history.map_len) return; //nothing new
+
+    char *map;
+    if(history.map == NULL)
+        map = mmap(NULL, size, PROT_READ, MAP_SHARED, history.fd, 0);
+    else
+        map = mremap(history.map, history.map_len, size, MREMAP_MAYMOVE);
+
+    if(map == MAP_FAILED) return; //keep the old mapping
+
+    history.map = map;
+    history.map_len = size;
+
+    //index the complete lines after the last indexed entry
+    size_t pos = history.offsets[history.n_entries];
+    char *newline;
+
+    while(pos < history.map_len && (newline = memchr(&history.map[pos], '\n', history.map_len - pos)) != NULL)
+    {
+        pos = newline - history.map + 1;
+
+        grow_array((void**)&history.offsets, &history.cap_offsets, history.n_entries + 2, sizeof(size_t));
+        history.offsets[++history.n_entries] = pos;
+    }
+}
+
+/**
+ * @brief Open (or create) the history file in the home directory and index it.
+ */
+void open_history()
+{
+    char *home = getenv("HOME");
+    if(home == NULL) return; //no history
+
+    char *path = (char*)malloc(strlen(home) + strlen(HISTORY_FILE_NAME) + 2);
+    assert(path != NULL);
+    sprintf(path, "%s/%s", home, HISTORY_FILE_NAME);
+
+    history.fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    free(path);
+
+    if(history.fd == -1) return; //no history
+
+    history.cap_offsets = 1024;
+    history.offsets = (size_t*)malloc(history.cap_offsets * sizeof(size_t));
+    assert(history.offsets != NULL);
+    history.offsets[0] = 0;
+
+    refresh_history();
+}
+
+/**
+ * @brief Get an entry of the history.
+ * @param i    Index of the entry.
+ * @param len  Pointer to where the entry length (without '\n') will be stored.
+ * @return Pointer to the entry text in the mapping (not NULL-terminated).
+ */
+char *history_entry(size_t i, size_t *len)
+{
+    assert(i < history.n_entries);
+
+    *len = history.offsets[i+1] - history.offsets[i] - 1;
+    return &history.map[history.offsets[i]];
+}
+
+/**
+ * @brief Find the entry that contains a position of the history file (binary search in the index).
+ * @param pos  Offset in the file.
+ * @return Index of the entry.
+ */
+size_t history_entry_at(size_t pos)
+{
+    size_t low = 0, high = history.n_entries; //the entry is in [low, high)
+
+    while(high - low > 1)
+    {
+        size_t middle = (low + high) / 2;
+
+        if(history.offsets[middle] <= pos) low = middle;
+        else high = middle;
+    }
+
+    return low;
+}
+
+/**
+ * @brief Append a line to the history (blank lines and repetitions of the last entry are ignored).
+ * @param line  Text of the line (without '\n').
+ */
+void append_history(char *line)
+{
+    assert(line != NULL);
+
+    if(history.fd == -1 || blank_string(line)) return;
+
+    refresh_history();
+
+    size_t len = strlen(line);
+    size_t last_len;
+
+    if(history.n_entries > 0)
+    {
+        char *last = history_entry(history.n_entries-1, &last_len);
+        if(last_len == len && !memcmp(last, line, len)) return; //same as the last entry
+    }
+
+    //a single write, so the entry is appended at once even with other shells writing
+    line[len] = '\n';
+    ssize_t retval = write(history.fd, line, len+1);
+    line[len] = '\0';
+
+    if(retval == -1)
+        fprintf(stderr, "WARNING: Cannot write the history file\n");
+}
+
+/**
+ * @brief Print a history entry with its number.
+ */
+void print_history_entry(size_t i)
+{
+    size_t len;
+    char *entry = history_entry(i, &len);
+
+    printf("%6zu  %.*s\n", i+1, (int)len, entry);
+}
+
+/**
+ * @brief Treatment function of the HISTORY command.
+ *        history [count]         prints the last entries (all of them without count).
+ *        history -s PATTERN      prints the entries that contain the pattern.
+ *        history -p PREFIX       prints the entries that begin with the prefix.
+ *        The searches scan the mapping of the file with 'memmem' (no per-entry work), and the
+ *        entry of each match is found by binary search in the index.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void history_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(history.fd == -1)
+    {
+        command_error("ERROR: There is no history file\n");
+        return;
+    }
+
+    refresh_history();
+
+    if(cmd_line->nargs == 0 || (cmd_line->nargs == 1 && cmd_line->args[0][0] != '-'))
+    {
+        size_t count = history.n_entries;
+
+        if(cmd_line->nargs == 1)
+            count = strtoul(cmd_line->args[0], NULL, 10);
+
+        if(count > history.n_entries) count = history.n_entries;
+
+        for(size_t i = history.n_entries - count; i < history.n_entries; i++)
+            print_history_entry(i);
+        return;
+    }
+
+    if(cmd_line->nargs != 2 || (strcmp(cmd_line->args[0], "-s") && strcmp(cmd_line->args[0], "-p")))
+    {
+        command_error("ERROR: The history syntax is: history [count]\n"
+               "\tor: history -s [pattern]\n"
+               "\tor: history -p [prefix]\n");
+        return;
+    }
+
+    int prefix = !strcmp(cmd_line->args[0], "-p");
+    char *pattern = cmd_line->args[1];
+    size_t pattern_len = strlen(pattern);
+
+    if(history.n_entries == 0) return;
+
+    size_t end = history.offsets[history.n_entries]; //end of the indexed entries
+
+    if(prefix) //an entry begins with the prefix if it is the first entry or the prefix follows a '\n'
+    {
+        size_t len;
+        char *first = history_entry(0, &len);
+
+        if(len >= pattern_len && !memcmp(first, pattern, pattern_len))
+            print_history_entry(0);
+
+        //search "\nPREFIX"
+        char *needle = (char*)malloc(pattern_len + 2);
+        assert(needle != NULL);
+        needle[0] = '\n';
+        strcpy(&needle[1], pattern);
+
+        char *match;
+        size_t pos = 0;
+
+        while(pos < end && (match = memmem(&history.map[pos], end - pos, needle, pattern_len+1)) != NULL)
+        {
+            size_t match_pos = match - history.map + 1;
+            if(match_pos >= end) break; //the '\n' of the last entry
+
+            print_history_entry(history_entry_at(match_pos));
+            pos = match_pos;
+        }
+
+        free(needle);
+    }
+    else
+    {
+        char *match;
+        size_t pos = 0;
+
+        while(pos < end && (match = memmem(&history.map[pos], end - pos, pattern, pattern_len)) != NULL)
+        {
+            size_t i = history_entry_at(match - history.map);
+            print_history_entry(i);
+            pos = history.offsets[i+1]; //go to the next entry
+        }
+    }
+}
+
+/**
+ * @brief State of the line editor.
+ * @param buffer   Text of the line.
+ * @param len      Length of the text.
+ * @param cursor   Position of the cursor in the text.
+ * @param prompt   Prompt printed before the text.
+ */
+typedef struct
+{
+    char buffer[MAX_LINE_LEN];
+    size_t len;
+    size_t cursor;
+    char *prompt;
+} line_editor_t;
+
+/**
+ * @brief Redraw the line being edited in the terminal.
+ */
+void redraw_line(line_editor_t *editor)
+{
+    //go to the beginning of the line, print prompt and text, clear the rest of the line
+    printf("\r%s%.*s\x1b[K", editor->prompt, (int)editor->len, editor->buffer);
+
+    if(editor->cursor < editor->len) //move the cursor back to its position
+        printf("\x1b[%zuD", editor->len - editor->cursor);
+
+    fflush(stdout);
+}
+
+/**
+ * @brief Replace the text of the line being edited.
+ */
+void set_editor_text(line_editor_t *editor, char *text, size_t len)
+{
+    if(len >= MAX_LINE_LEN) len = MAX_LINE_LEN - 1;
+
+    memcpy(editor->buffer, text, len);
+    editor->len = len;
+    editor->cursor = len;
+}
+
+#define MAX_LISTED_COMPLETIONS 100 //Maximum number of completions printed in the list
+
+/**
+ * @brief Candidates of a Tab completion.
+ * @param items      Candidate names (the directories end with '/').
+ * @param n_items    Number of candidates.
+ * @param cap_items  Capacity of the items array.
+ */
+typedef struct
+{
+    char **items;
+    size_t n_items, cap_items;
+} completion_list_t;
+
+/**
+ * @brief Add a candidate to the completion list.
+ */
+void add_completion(completion_list_t *list, char *name, int directory)
+{
+    grow_array((void**)&list->items, &list->cap_items, list->n_items, sizeof(char*));
+
+    char *item = (char*)malloc(strlen(name) + 2);
+    assert(item != NULL);
+    sprintf(item, directory ? "%s/" : "%s", name);
+
+    list->items[list->n_items++] = item;
+}
+
+/**
+ * @brief Tree visitor that adds the command tokens to the completion list.
+ */
+void visit_command_completion(char *token, alphabetical_tree_node_t *node, void *data)
+{
+    if(node->cmd_callback != NULL) add_completion((completion_list_t*)data, token, 0);
+}
+
+/**
+ * @brief Tree visitor that adds the variable names to the completion list.
+ */
+void visit_variable_completion(char *token, alphabetical_tree_node_t *node, void *data)
+{
+    if(node->text != NULL) add_completion((completion_list_t*)data, token, 0);
+}
+
+/**
+ * @brief Add the entries of a directory that begin with a prefix to the completion list.
+ * @param list    Pointer to the completion list.
+ * @param word    Typed path (directory part and prefix of the entry name).
+ * @return Length of the prefix of the entry name (the part of the word being completed).
+ */
+size_t add_path_completions(completion_list_t *list, char *word)
+{
+    char *slash = strrchr(word, '/');
+    char *prefix = slash == NULL ? word : slash + 1;
+
+    //absolute path of the directory
+    char path[PATH_MAX + MAX_LINE_LEN]; //working directory and the directory part of the word (from the line)
+    size_t dir_len = slash == NULL ? 0 : slash - word + 1;
+
+    if(word[0] == '/')
+        sprintf(path, "%.*s", (int)dir_len, word);
+    else
+    {
+        if(getcwd(path, PATH_MAX) == NULL) return strlen(prefix); //no completions
+        sprintf(&path[strlen(path)], "/%.*s", (int)dir_len, word);
+    }
+
+    dir_cache_t *dir = get_dir_cache(path);
+    if(dir == NULL) return strlen(prefix);
+
+    size_t prefix_len = strlen(prefix);
+
+    for(size_t i = dir_cache_lower_bound(dir, prefix); i < dir->n_sorted; i++)
+    {
+        char *name = dir_cache_name(dir, dir->sorted[i]);
+
+        if(strncmp(name, prefix, prefix_len)) break; //the sorted entries with the prefix are over
+
+        if(name[0] == '.' && prefix[0] != '.') continue; //hidden entries only if asked
+
+        add_completion(list, name, dir->types[dir->sorted[i]] == DT_DIR);
+    }
+
+    return prefix_len;
+}
+
+/**
+ * @brief Complete the word before the cursor of the line editor (Tab key).
+ *        The first word is completed with commands, '$' words with variables and the others with paths.
+ *        If the candidates have nothing more in common, they are listed.
+ */
+void complete_line(line_editor_t *editor)
+{
+    //find the word before the cursor
+    size_t start = editor->cursor;
+    while(start > 0 && editor->buffer[start-1] != ' ' && editor->buffer[start-1] != '\t') start--;
+
+    char word[MAX_LINE_LEN];
+    size_t word_len = editor->cursor - start;
+    memcpy(word, &editor->buffer[start], word_len);
+    word[word_len] = '\0';
+
+    int first_word = 1;
+    for(size_t i = 0; i < start; i++)
+    {
+        if(editor->buffer[i] != ' ' && editor->buffer[i] != '\t') first_word = 0;
+    }
+
+    completion_list_t list = {NULL, 0, 0};
+    size_t completed_len; //length of the part of the word that the candidates complete
+    int add_space = 1; //add a space after a single candidate
+
+    if(first_word)
+    {
+        string_to_lower(word);
+        if(alphabetical_string(word)) walk_tokens_with_prefix(dictionary, word, visit_command_completion, &list);
+        completed_len = word_len;
+    }
+    else if(word[0] == '$')
+    {
+        materialize_state_images(); //the names of the loaded images are in the tree
+        if(alphabetical_string(&word[1])) walk_tokens_with_prefix(variables, &word[1], visit_variable_completion, &list);
+        completed_len = word_len - 1;
+    }
+    else
+    {
+        completed_len = add_path_completions(&list, word);
+    }
+
+    if(list.n_items > 0)
+    {
+        //longest common prefix of the candidates
+        size_t common = strlen(list.items[0]);
+        for(size_t i = 1; i < list.n_items; i++)
+        {
+            size_t j = 0;
+            while(j < common && list.items[i][j] == list.items[0][j]) j++;
+            common = j;
+        }
+
+        if(list.n_items == 1 && list.items[0][common-1] == '/') add_space = 0; //keep completing the directory
+
+        size_t insert_len = common > completed_len ? common - completed_len : 0;
+        if(list.n_items == 1 && add_space) insert_len++; //the space
+
+        if(editor->len + insert_len < MAX_LINE_LEN)
+        {
+            memmove(&editor->buffer[editor->cursor + insert_len], &editor->buffer[editor->cursor], editor->len - editor->cursor);
+            memcpy(&editor->buffer[editor->cursor], &list.items[0][completed_len], common - completed_len);
+
+            if(list.n_items == 1 && add_space) editor->buffer[editor->cursor + insert_len - 1] = ' ';
+
+            editor->cursor += insert_len;
+            editor->len += insert_len;
+        }
+
+        if(list.n_items > 1 && common <= completed_len) //nothing to insert: list the candidates
+        {
+            printf("\n");
+            for(size_t i = 0; i < list.n_items && i < MAX_LISTED_COMPLETIONS; i++)
+                printf("%s  ", list.items[i]);
+
+            if(list.n_items > MAX_LISTED_COMPLETIONS)
+                printf("... (%zu more)", list.n_items - MAX_LISTED_COMPLETIONS);
+            printf("\n");
+        }
+    }
+
+    for(size_t i = 0; i < list.n_items; i++)
+        free(list.items[i]);
+    free(list.items);
+}
+
+/**
+ * @brief Read a line from the terminal in raw mode, with cursor movement, history recall (up and down arrows)
+ *        and Tab completion.
+ * @param prompt  Prompt printed before the line.
+ * @return The line text (owned by the caller), or NULL at the end of the input (Ctrl-D on an empty line).
+ */
+char *edit_line(char *prompt)
+{
+    struct termios cooked, raw;
+    tcgetattr(STDIN_FILENO, &cooked);
+
+    raw = cooked;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG); //byte by byte, without echo and signals
+    raw.c_iflag &= ~(ICRNL | IXON);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+    line_editor_t editor;
+    editor.len = 0;
+    editor.cursor = 0;
+    editor.prompt = prompt;
+
+    refresh_history();
+    size_t recall = history.n_entries; //history entry shown (n_entries means the typed line)
+    char typed[MAX_LINE_LEN]; //typed line, saved while recalling entries
+    size_t typed_len = 0;
+
+    int done = 0, eof = 0;
+    redraw_line(&editor);
+
+    while(!done)
+    {
+        unsigned char c;
+        if(read(STDIN_FILENO, &c, 1) != 1) { eof = 1; break; }
+
+        switch(c)
+        {
+            case '\r':
+            case '\n': //end of line
+                done = 1;
+                break;
+
+            case '\t': //completion
+                complete_line(&editor);
+                break;
+
+            case 4: //Ctrl-D
+                if(editor.len == 0) { eof = 1; done = 1; }
+                break;
+
+            case 3: //Ctrl-C: discard the line
+                editor.len = editor.cursor = 0;
+                printf("^C\n");
+                break;
+
+            case 127:
+            case 8: //backspace
+                if(editor.cursor > 0)
+                {
+                    memmove(&editor.buffer[editor.cursor-1], &editor.buffer[editor.cursor], editor.len - editor.cursor);
+                    editor.cursor--;
+                    editor.len--;
+                }
+                break;
+
+            case 27: //escape sequence (arrows, Delete, ...)
+            {
+                unsigned char seq[2];
+                if(read(STDIN_FILENO, seq, 2) != 2 || seq[0] != '[') break;
+
+                if(seq[1] >= '0' && seq[1] <= '9') //'ESC [ number ~' keys: read the sequence up to its final char
+                {
+                    unsigned char number = seq[1], last = seq[1];
+
+                    while(last >= 0x20 && last < 0x40 && read(STDIN_FILENO, &last, 1) == 1);
+
+                    if(number == '3' && last == '~' && editor.cursor < editor.len) //Delete: remove the char under the cursor
+                    {
+                        memmove(&editor.buffer[editor.cursor], &editor.buffer[editor.cursor+1], editor.len - editor.cursor - 1);
+                        editor.len--;
+                    }
+                    break;
+                }
+
+                if(seq[1] == 'A' && recall > 0) //up: previous entry
+                {
+                    if(recall == history.n_entries) //save the typed line
+                    {
+                        memcpy(typed, editor.buffer, editor.len);
+                        typed_len = editor.len;
+                    }
+
+                    size_t len;
+                    char *entry = history_entry(--recall, &len);
+                    set_editor_text(&editor, entry, len);
+                }
+                else if(seq[1] == 'B' && recall < history.n_entries) //down: next entry
+                {
+                    if(++recall == history.n_entries)
+                        set_editor_text(&editor, typed, typed_len);
+                    else
+                    {
+                        size_t len;
+                        char *entry = history_entry(recall, &len);
+                        set_editor_text(&editor, entry, len);
+                    }
+                }
+                else if(seq[1] == 'C' && editor.cursor < editor.len) editor.cursor++; //right
+                else if(seq[1] == 'D' && editor.cursor > 0) editor.cursor--; //left
+                break;
+            }
+
+            default: //insert a printable char
+                if(c >= ' ' && editor.len < MAX_LINE_LEN - 1)
+                {
+                    memmove(&editor.buffer[editor.cursor+1], &editor.buffer[editor.cursor], editor.len - editor.cursor);
+                    editor.buffer[editor.cursor++] = c;
+                    editor.len++;
+                }
+        }
+
+        if(!done) redraw_line(&editor);
+    }
+
+    printf("\n");
+    fflush(stdout);
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &cooked); //programs and commands run in cooked mode
+
+    if(eof && editor.len == 0) return NULL;
+
+    return strndup(editor.buffer, editor.len);
+}
+
+/**
+ * @brief Prompt and read a line of the input. The terminal uses the line editor; other inputs (pipes, files) are read directly.
+ * @param prompt  Prompt printed before the line.
+ * @return The line text without '\n' (owned by the caller), or NULL at the end of the input.
+ */
+char *read_line(char *prompt)
+{
+    if(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO))
+        return edit_line(prompt);
+
+    printf("%s", prompt);
+    fflush(stdout);
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len = getline(&line, &cap, stdin);
+
+    if(len == -1) //end of input
+    {
+        free(line);
+        return NULL;
+    }
+
+    if(len > 0 && line[len-1] == '\n') line[len-1] = '\0';
+
+    return line;
+}
+
+/**
+ * @brief Read, record in the history and parse a line of the input.
+ *        Only the lines typed on a terminal are recorded (not the lines of pipes and scripts).
+ * @param prompt  Prompt printed before the line.
+ * @param list    Pointer to the working cmd_list_t struct buffer.
+ * @return LINE_READ, LINE_BLANK, LINE_ERROR (syntax error) or LINE_END (end of the input).
+ */
+int read_input_cmd_list(char *prompt, cmd_list_t *list)
+{
+    char *line = read_line(prompt);
+    if(line == NULL) return LINE_END;
+
+    if(isatty(STDIN_FILENO)) append_history(line);
+    int parsed = parse_cmd_list(list, line);
+    free(line);
+
+    return parsed;
+}
+
+// ==================================================
+// =============== EXPRESSION FEATURES ==============
+// ==================================================
+
+/*
+ * 'let' lines are compiled once into a small postfix code of typed values. Variable nodes are resolved
+ * and number literals are parsed at compile time, and the variables keep their numbers in binary,
+ * so a counter updated by 'let' in a loop never goes through a text.
+ */
+
+#define EXPR_MAX_DEPTH 64 //Maximum depth of the value stack of an expression
+
+/**
+ * @brief Operations of the postfix code of an expression.
+ */
+typedef enum
+{
+    EXPR_NUMBER,   //push 'value'
+    EXPR_VARIABLE, //push the number of 'slot'
+    EXPR_LENGTH,   //push the length of the text of 'slot'
+    EXPR_NEGATE,   //change the sign of the top value
+    EXPR_ADD,      //pop two values and push their sum
+    EXPR_SUB,      //pop two values and push their difference
+    EXPR_MUL,      //pop two values and push their product
+    EXPR_DIV,      //pop two values and push their quotient (truncated for integers)
+    EXPR_MOD       //pop two integers and push the remainder of their division
+} expr_op_t;
+
+/**
+ * @brief Item of the postfix code.
+ * @param op     Operation (expr_op_t).
+ * @param value  Number of EXPR_NUMBER items.
+ * @param slot   Variable of EXPR_VARIABLE and EXPR_LENGTH items.
+ */
+typedef struct
+{
+    unsigned char op;
+    value_t value;
+    alphabetical_tree_node_t *slot;
+} expr_item_t;
+
+/**
+ * @brief Compiled 'let' line: [var] = [expression] or [var] = substring [var] [start] [count].
+ * @param slot      Destination variable.
+ * @param source    Text variable of 'substring' (NULL for expressions).
+ * @param items     Postfix code of the expression (or of the start and count of 'substring').
+ * @param n_items   Number of items.
+ * @param n_values  Number of values left by the code (1 for expressions, 1 or 2 for 'substring').
+ */
+typedef struct
+{
+    alphabetical_tree_node_t *slot;
+    alphabetical_tree_node_t *source;
+    expr_item_t *items;
+    size_t n_items, cap_items;
+    size_t n_values;
+} let_t;
+
+/**
+ * @brief State of the compilation of an expression (recursive descent on the tokens).
+ * @param tokens    Tokens of the expression.
+ * @param n_tokens  Number of tokens.
+ * @param pos       Index of the next token.
+ * @param depth     Values on the stack after the items emitted so far.
+ * @param failed    1 (true) if an error has been found. Otherwise, 0 (false).
+ * @param let       Compiled line that receives the items.
+ */
+typedef struct
+{
+    char **tokens;
+    size_t n_tokens;
+    size_t pos;
+    size_t depth;
+    int failed;
+    let_t *let;
+} expr_parser_t;
+
+/**
+ * @brief Append an item to the code of the 'let' line.
+ * @param parser  Pointer to the parser.
+ * @param op      Operation (expr_op_t).
+ * @param value   Number of EXPR_NUMBER items (NULL for the other items).
+ * @param slot    Variable of EXPR_VARIABLE and EXPR_LENGTH items (NULL for the other items).
+ */
+void emit_expr_item(expr_parser_t *parser, expr_op_t op, value_t *value, alphabetical_tree_node_t *slot)
+{
+    let_t *let = parser->let;
+    grow_array((void**)&let->items, &let->cap_items, let->n_items, sizeof(expr_item_t));
+
+    expr_item_t *item = &let->items[let->n_items++];
+    item->op = op;
+    item->slot = slot;
+    if(value != NULL) item->value = *value;
+
+    if(op == EXPR_NUMBER || op == EXPR_VARIABLE || op == EXPR_LENGTH) parser->depth++;
+    else if(op != EXPR_NEGATE) parser->depth--;
+
+    if(parser->depth > EXPR_MAX_DEPTH && !parser->failed)
+    {
+        command_error("ERROR: The expression is too deep\n");
+        parser->failed = 1;
+    }
+}
+
+/**
+ * @brief Get the next token of the expression.
+ * @return The token, or NULL at the end of the expression.
+ */
+char *peek_expr_token(expr_parser_t *parser)
+{
+    return parser->pos < parser->n_tokens ? parser->tokens[parser->pos] : NULL;
+}
+
+/**
+ * @brief Get the node of a variable of the expression ('name' or '$name').
+ * @return Pointer to the variable's node, or NULL if the token is not a variable name (the error is printed).
+ */
+alphabetical_tree_node_t *expr_variable(expr_parser_t *parser, char *token)
+{
+    char *name = token[0] == '$' ? &token[1] : token;
+
+    if(name[0] == '\0' || !alphabetical_string(name))
+    {
+        command_error("ERROR: \'%s\' is not a number or a variable name (separate the operators with spaces)\n", token);
+        parser->failed = 1;
+        return NULL;
+    }
+
+    return variable_slot(name);
+}
+
+/**
+ * @brief Compile a single operand: a number or a variable.
+ */
+void compile_expr_operand(expr_parser_t *parser)
+{
+    char *token = peek_expr_token(parser);
+
+    if(token == NULL)
+    {
+        command_error("ERROR: Missing operand at the end of the expression\n");
+        parser->failed = 1;
+        return;
+    }
+
+    parser->pos++;
+    value_t value;
+
+    if(parse_number(token, &value)) //literals are parsed only here
+    {
+        emit_expr_item(parser, EXPR_NUMBER, &value, NULL);
+        return;
+    }
+
+    alphabetical_tree_node_t *slot = expr_variable(parser, token);
+    if(slot != NULL) emit_expr_item(parser, EXPR_VARIABLE, NULL, slot);
+}
+
+void compile_expr_sum(expr_parser_t *parser);
+
+/**
+ * @brief Compile a factor: an operand, '- factor', '( sum )' or 'length var'.
+ */
+void compile_expr_factor(expr_parser_t *parser)
+{
+    char *token = peek_expr_token(parser);
+
+    if(token != NULL && !strcmp(token, "-"))
+    {
+        parser->pos++;
+        compile_expr_factor(parser);
+        emit_expr_item(parser, EXPR_NEGATE, NULL, NULL);
+    }
+    else if(token != NULL && !strcmp(token, "("))
+    {
+        parser->pos++;
+        compile_expr_sum(parser);
+
+        token = peek_expr_token(parser);
+        if(token == NULL || strcmp(token, ")"))
+        {
+            command_error("ERROR: Missing \')\' in the expression\n");
+            parser->failed = 1;
+            return;
+        }
+        parser->pos++;
+    }
+    else if(token != NULL && !strcmp(token, "length"))
+    {
+        parser->pos++;
+        token = peek_expr_token(parser);
+
+        if(token == NULL)
+        {
+            command_error("ERROR: The \'length\' syntax is: length [varname]\n");
+            parser->failed = 1;
+            return;
+        }
+
+        parser->pos++;
+        alphabetical_tree_node_t *slot = expr_variable(parser, token);
+        if(slot != NULL) emit_expr_item(parser, EXPR_LENGTH, NULL, slot);
+    }
+    else compile_expr_operand(parser);
+}
+
+/**
+ * @brief Compile a product: factors separated by '*', '/' or '%'.
+ */
+void compile_expr_product(expr_parser_t *parser)
+{
+    compile_expr_factor(parser);
+
+    char *token;
+    while(!parser->failed && (token = peek_expr_token(parser)) != NULL)
+    {
+        expr_op_t op;
+
+        if(!strcmp(token, "*")) op = EXPR_MUL;
+        else if(!strcmp(token, "/")) op = EXPR_DIV;
+        else if(!strcmp(token, "%")) op = EXPR_MOD;
+        else return;
+
+        parser->pos++;
+        compile_expr_factor(parser);
+        emit_expr_item(parser, op, NULL, NULL);
+    }
+}
+
+/**
+ * @brief Compile a sum: products separated by '+' or '-'.
+ */
+void compile_expr_sum(expr_parser_t *parser)
+{
+    compile_expr_product(parser);
+
+    char *token;
+    while(!parser->failed && (token = peek_expr_token(parser)) != NULL)
+    {
+        expr_op_t op;
+
+        if(!strcmp(token, "+")) op = EXPR_ADD;
+        else if(!strcmp(token, "-")) op = EXPR_SUB;
+        else return;
+
+        parser->pos++;
+        compile_expr_product(parser);
+        emit_expr_item(parser, op, NULL, NULL);
+    }
+}
+
+/**
+ * @brief Free the code of a compiled 'let' line.
+ */
+void destroy_let(let_t *let)
+{
+    free(let->items);
+    let->items = NULL;
+    let->n_items = let->cap_items = 0;
+}
+
+/**
+ * @brief Compile a 'let' line from its typed tokens: [var] = [expression] or [var] = substring [var] [start] [count].
+ * @param let       Pointer to where the compiled line will be stored.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the 'let' tokens.
+ * @return 1 (true) if the line has been compiled. Otherwise (the error is printed), returns 0 (false).
+ */
+int compile_let(let_t *let, cmd_line_t *cmd_line)
+{
+    assert(let != NULL);
+    assert(cmd_line != NULL);
+
+    memset(let, 0, sizeof(let_t));
+
+    if(cmd_line->n_tokens < 3 || strcmp(cmd_line->tokens[1], "=") || !alphabetical_string(cmd_line->tokens[0]))
+    {
+        command_error("ERROR: The \'let\' syntax is: let [varname] = [expression]\n"
+                      "\tor: let [varname] = substring [varname] [start] [count]\n");
+        return 0;
+    }
+
+    expr_parser_t parser = {&cmd_line->tokens[2], cmd_line->n_tokens - 2, 0, 0, 0, let};
+    let->slot = variable_slot(cmd_line->tokens[0]);
+
+    if(!strcmp(parser.tokens[0], "substring")) //the start and the count are single operands
+    {
+        if(parser.n_tokens != 3 && parser.n_tokens != 4)
+        {
+            command_error("ERROR: The \'substring\' syntax is: substring [varname] [start] [count]\n");
+            return 0;
+        }
+
+        let->source = expr_variable(&parser, parser.tokens[1]);
+        parser.pos = 2;
+
+        while(!parser.failed && parser.pos < parser.n_tokens)
+            compile_expr_operand(&parser);
+    }
+    else
+    {
+        compile_expr_sum(&parser);
+
+        if(!parser.failed && parser.pos < parser.n_tokens)
+        {
+            command_error("ERROR: Unexpected \'%s\' in the expression\n", parser.tokens[parser.pos]);
+            parser.failed = 1;
+        }
+    }
+
+    if(parser.failed)
+    {
+        destroy_let(let);
+        return 0;
+    }
+
+    let->n_values = parser.depth;
+    return 1;
+}
+
+/**
+ * @brief Get the number of a variable. A text is parsed here (it stays a text in the variable).
+ * @return 1 (true) if the variable has a number. Otherwise (the error is printed), returns 0 (false).
+ */
+int variable_number(alphabetical_tree_node_t *slot, value_t *value)
+{
+    if(slot->text == NULL)
+    {
+        command_error("ERROR: Variable not found in the expression\n");
+        return 0;
+    }
+
+    if(slot->value.type != VALUE_TEXT)
+    {
+        *value = slot->value;
+        return 1;
+    }
+
+    if(parse_number(slot->text, value)) return 1;
+
+    command_error("ERROR: \'%s\' is not a number\n", slot->text);
+    return 0;
+}
+
+/**
+ * @brief Get a number as a float.
+ */
+double number_as_real(value_t *value)
+{
+    return value->type == VALUE_INT ? (double)value->integer : value->real;
+}
+
+/**
+ * @brief Compare two numbers (integers are compared exactly, the other pairs as floats).
+ * @return A negative value if a < b, 0 if a == b or a positive value if a > b.
+ */
+int compare_numbers(value_t *a, value_t *b)
+{
+    if(a->type == VALUE_INT && b->type == VALUE_INT)
+        return (a->integer > b->integer) - (a->integer < b->integer);
+
+    double x = number_as_real(a), y = number_as_real(b);
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Apply a binary operation to two numbers. Two integers give an integer, any float gives a float.
+ * @param op  Operation (EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV or EXPR_MOD).
+ * @param a   Pointer to the left number, where the result will be stored.
+ * @param b   Pointer to the right number.
+ * @return 1 (true) on success. Otherwise (the error is printed), returns 0 (false).
+ */
+int apply_expr_operator(expr_op_t op, value_t *a, value_t *b)
+{
+    if(a->type == VALUE_INT && b->type == VALUE_INT)
+    {
+        long long x = a->integer, y = b->integer;
+        int overflow = 0;
+
+        if((op == EXPR_DIV || op == EXPR_MOD) && y == 0)
+        {
+            command_error("ERROR: Division by zero\n");
+            return 0;
+        }
+
+        switch(op)
+        {
+            case EXPR_ADD: overflow = __builtin_add_overflow(x, y, &a->integer); break;
+            case EXPR_SUB: overflow = __builtin_sub_overflow(x, y, &a->integer); break;
+            case EXPR_MUL: overflow = __builtin_mul_overflow(x, y, &a->integer); break;
+            default: //division and remainder
+                overflow = x == LLONG_MIN && y == -1;
+                if(!overflow) a->integer = op == EXPR_DIV ? x / y : x % y;
+                break;
+        }
+
+        if(overflow) command_error("ERROR: Integer overflow in the expression\n");
+        return !overflow;
+    }
+
+    if(op == EXPR_MOD)
+    {
+        command_error("ERROR: The \'%%\' operands must be integers\n");
+        return 0;
+    }
+
+    double x = number_as_real(a), y = number_as_real(b);
+
+    a->type = VALUE_FLOAT;
+    if(op == EXPR_ADD) a->real = x + y;
+    else if(op == EXPR_SUB) a->real = x - y;
+    else if(op == EXPR_MUL) a->real = x * y;
+    else a->real = x / y;
+
+    return 1;
+}
+
+/**
+ * @brief Run the postfix code of a 'let' line.
+ * @param let     Pointer to the compiled line.
+ * @param values  Array where the values left by the code will be stored (let->n_values).
+ * @return 1 (true) on success. Otherwise (the error is printed), returns 0 (false).
+ */
+int eval_let(let_t *let, value_t *values)
+{
+    value_t stack[EXPR_MAX_DEPTH];
+    size_t top = 0; //number of values on the stack
+
+    for(size_t i = 0; i < let->n_items; i++)
+    {
+        expr_item_t *item = &let->items[i];
+
+        switch(item->op)
+        {
+            case EXPR_NUMBER:
+                stack[top++] = item->value;
+                break;
+
+            case EXPR_VARIABLE:
+                if(!variable_number(item->slot, &stack[top++])) return 0;
+                break;
+
+            case EXPR_LENGTH:
+            {
+                char *text = variable_text(item->slot);
+
+                if(text == NULL)
+                {
+                    command_error("ERROR: Variable not found in the expression\n");
+                    return 0;
+                }
+
+                stack[top].type = VALUE_INT;
+                stack[top++].integer = strlen(text);
+                break;
+            }
+
+            case EXPR_NEGATE:
+            {
+                value_t *value = &stack[top-1];
+
+                if(value->type == VALUE_FLOAT) value->real = -value->real;
+                else if(value->integer == LLONG_MIN)
+                {
+                    command_error("ERROR: Integer overflow in the expression\n");
+                    return 0;
+                }
+                else value->integer = -value->integer;
+                break;
+            }
+
+            default: //binary operations
+                top--;
+                if(!apply_expr_operator(item->op, &stack[top-1], &stack[top])) return 0;
+                break;
+        }
+    }
+
+    assert(top == let->n_values);
+    memcpy(values, stack, top * sizeof(value_t));
+    return 1;
+}
+
+/**
+ * @brief Assign the substring of the source variable of a 'let' line (byte positions, the count is optional).
+ * @return 1 (true) on success. Otherwise (the error is printed), returns 0 (false).
+ */
+int assign_substring(let_t *let, value_t *values)
+{
+    char *text = variable_text(let->source);
+
+    if(text == NULL)
+    {
+        command_error("ERROR: Variable not found in the expression\n");
+        return 0;
+    }
+
+    for(size_t i = 0; i < let->n_values; i++)
+    {
+        if(values[i].type != VALUE_INT || values[i].integer < 0)
+        {
+            command_error("ERROR: The \'substring\' start and count must be non-negative integers\n");
+            return 0;
+        }
+    }
+
+    //non-negative, so they compare as size_t
+    size_t len = strlen(text);
+    size_t start = (size_t)values[0].integer < len ? (size_t)values[0].integer : len;
+    size_t count = len - start;
+
+    if(let->n_values == 2 && (size_t)values[1].integer < count) count = (size_t)values[1].integer;
+
+    char *buffer = strndup(&text[start], count); //copied before the destination (it can be the source) changes
+    assert(buffer != NULL);
+
+    assign_variable_buffer(let->slot, buffer);
+    return 1;
+}
+
+/**
+ * @brief Run a compiled 'let' line and assign its result.
+ */
+void run_let(let_t *let)
+{
+    value_t values[2];
+
+    last_status = EXIT_SUCCESS;
+
+    if(!eval_let(let, values)) return;
+
+    if(let->source != NULL) assign_substring(let, values);
+    else assign_variable_number(let->slot, &values[0]);
+}
+
+/**
+ * @brief Treatment function of the LET command.
+ *        It reads the typed tokens ('*' is not a glob pattern here). Inside blocks, the line is compiled once.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void let_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    let_t let;
+
+    if(!compile_let(&let, cmd_line)) return;
+
+    run_let(&let);
+    destroy_let(&let);
+}
+
+/**
+ * @brief Treatment function of the SPLIT command: split [text] by [separator] into [var] ... [var].
+ *        Each variable gets a piece of the text, the last one gets the rest (variables without pieces get empty texts).
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ */
+void split_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    if(cmd_line->nargs < 5 || strcmp(cmd_line->args[1], "by") || strcmp(cmd_line->args[3], "into") ||
+       cmd_line->args[2][0] == '\0')
+    {
+        command_error("ERROR: The \'split\' syntax is: split [text] by [separator] into [varname] ... [varname]\n");
+        return;
+    }
+
+    for(size_t i = 4; i < cmd_line->nargs; i++)
+    {
+        if(!alphabetical_string(cmd_line->args[i]))
+        {
+            command_error("ERROR: Variable's names must have only alphabetical chars\n");
+            return;
+        }
+    }
+
+    //the text can be the content of a destination variable, which changes during the split
+    char *text = strdup(cmd_line->args[0]);
+    assert(text != NULL);
+
+    char *separator = cmd_line->args[2];
+    size_t separator_len = strlen(separator);
+    char *piece = text;
+
+    for(size_t i = 4; i < cmd_line->nargs; i++)
+    {
+        char *end = i+1 < cmd_line->nargs ? strstr(piece, separator) : NULL;
+        size_t len = end == NULL ? strlen(piece) : (size_t)(end - piece);
+
+        char *buffer = strndup(piece, len);
+        assert(buffer != NULL);
+
+        assign_variable_buffer(variable_slot(cmd_line->args[i]), buffer);
+
+        piece = end == NULL ? &piece[len] : end + separator_len; //at the end, the other variables get ""
+    }
+
+    free(text);
+}
+
+// ====================================================
+// =============== CONTROL FLOW FEATURES ==============
+// ====================================================
+
+/*
+ * Blocks (for, while, if and repeat) are read until their 'end' line and compiled once into a
+ * small bytecode program. Command callbacks and variable nodes are resolved at compile time,
+ * so the iterations of a loop do not pass through the lexer or the command tree again.
+ * 'let' lines become OP_LET instructions with their compiled expressions (no command calls).
+ */
+
+/**
+ * @brief Operation codes of the bytecode.
+ */
+typedef enum
+{
+    OP_CALL,        //call 'calls[arg]'
+    OP_LET,         //run 'lets[arg]'
+    OP_JUMP,        //go to 'target'
+    OP_JUMP_UNLESS, //go to 'target' if 'conds[arg]' is false
+    OP_JUMP_FAILED, //go to 'target' if the last command has failed (the command after '&&' is skipped)
+    OP_JUMP_SUCCEEDED, //go to 'target' if the last command has succeeded (the command after '||' is skipped)
+    OP_LOOP_INIT,   //reset the counter of 'loops[arg]'
+    OP_FOR_NEXT,    //assign the next item of 'loops[arg]' to its variable, or go to 'target' if there is no next item
+    OP_REPEAT_NEXT, //count one more iteration of 'loops[arg]', or go to 'target' if the count has been reached
+    OP_HALT         //end of the program
+} opcode_t;
+
+/**
+ * @brief Bytecode instruction.
+ * @param op      Operation code (opcode_t).
+ * @param arg     Index in the table used by the operation (calls, lets, conds or loops).
+ * @param target  Instruction index for jumps.
+ */
+typedef struct
+{
+    unsigned char op;
+    unsigned int arg;
+    unsigned int target;
+} instruction_t;
+
+/**
+ * @brief Operand of conditions and loops: a variable slot or a literal text.
+ * @param slot     Pointer to the variable's node (NULL for literals).
+ * @param literal  Literal text (NULL for variables).
+ * @param number   Number of the literal, parsed at compile time (VALUE_TEXT if it is not a number or for variables).
+ */
+typedef struct
+{
+    alphabetical_tree_node_t *slot;
+    char *literal;
+    value_t number;
+} operand_t;
+
+/**
+ * @brief Command call with its callback already resolved.
+ * @param callback  Function that performs the command.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer given to the callback.
+ */
+typedef struct
+{
+    void (*callback)(cmd_line_t*);
+    cmd_line_t *cmd_line;
+} call_t;
+
+#define COND_IS 0    //equal texts (or equal numbers)
+#define COND_ISNOT 1 //different texts (or different numbers)
+#define COND_LT 2    //left number < right number
+#define COND_LE 3    //left number <= right number
+#define COND_GT 4    //left number > right number
+#define COND_GE 5    //left number >= right number
+
+/**
+ * @brief Condition of the 'if' and 'while' blocks: [left] [relation] [right].
+ * @param relation  COND_IS, COND_ISNOT, COND_LT, COND_LE, COND_GT or COND_GE.
+ */
+typedef struct
+{
+    operand_t left;
+    operand_t right;
+    int relation;
+} condition_t;
+
+/**
+ * @brief State of the 'for' and 'repeat' blocks.
+ * @param slot     Loop variable (only for 'for').
+ * @param items    Items of the 'for' block, or the count operand of the 'repeat' block.
+ * @param n_items  Number of items.
+ * @param counter  Iterations done (runtime state).
+ * @param limit    Number of iterations of the 'repeat' block (runtime state).
+ */
+typedef struct
+{
+    alphabetical_tree_node_t *slot;
+    operand_t *items;
+    size_t n_items;
+    size_t counter;
+    size_t limit;
+} loop_t;
+
+/**
+ * @brief Compiled bytecode program with its tables.
+ * @param failed  1 (true) if a compilation error has been found. Otherwise, 0 (false).
+ */
+typedef struct
+{
+    instruction_t *code;
+    size_t n_code, cap_code;
+
+    call_t *calls;
+    size_t n_calls, cap_calls;
+
+    let_t *lets;
+    size_t n_lets, cap_lets;
+
+    condition_t *conds;
+    size_t n_conds, cap_conds;
+
+    loop_t *loops;
+    size_t n_loops, cap_loops;
+
+    int failed;
+} program_t;
+
+/**
+ * @brief Append an instruction to the program.
+ * @return Index of the new instruction.
+ */
+size_t emit_instruction(program_t *p, opcode_t op, size_t arg, size_t target)
+{
+    grow_array((void**)&p->code, &p->cap_code, p->n_code, sizeof(instruction_t));
+
+    p->code[p->n_code].op = op;
+    p->code[p->n_code].arg = arg;
+    p->code[p->n_code].target = target;
+
+    return p->n_code++;
+}
+
+/**
+ * @brief Build an operand from an argument token ($varname, $$text or text).
+ * @param p      Pointer to the program (its 'failed' flag is set on errors).
+ * @param token  Argument token.
+ */
+operand_t compile_operand(program_t *p, char *token)
+{
+    operand_t operand = {NULL, NULL, {VALUE_TEXT}};
+
+    if(token[0] == '$' && token[1] != '$') //variable
+    {
+        if(!alphabetical_string(&token[1]) || token[1] == '\0')
+        {
+            command_error("ERROR: Variable's names have only alphabetical chars\n");
+            p->failed = 1;
+            operand.literal = strdup("");
+        }
+        else operand.slot = variable_slot(&token[1]);
+    }
+    else if(token[0] == '$') //'$$text' means the '$text' literal
+        operand.literal = strdup(&token[1]);
+    else
+        operand.literal = strdup(token);
+
+    if(operand.literal != NULL && !parse_number(operand.literal, &operand.number))
+        operand.number.type = VALUE_TEXT;
+
+    return operand;
+}
+
+/**
+ * @brief Get the current text of an operand.
+ * @return The text, or NULL if the operand is a variable without content.
+ */
+char *operand_text(operand_t *operand)
+{
+    if(operand->slot == NULL) return operand->literal;
+    return variable_text(operand->slot);
+}
+
+/**
+ * @brief Get the number of an operand: a number literal, a variable with a number or a variable whose text is a number.
+ * @param operand  Pointer to the operand.
+ * @param value    Pointer to where the number will be stored.
+ * @return 1 (true) if the operand has a number. Otherwise, returns 0 (false).
+ */
+int operand_number(operand_t *operand, value_t *value)
+{
+    if(operand->slot == NULL) *value = operand->number;
+    else if(operand->slot->text == NULL) return 0;
+    else if(operand->slot->value.type != VALUE_TEXT) *value = operand->slot->value;
+    else return parse_number(operand->slot->text, value);
+
+    return value->type != VALUE_TEXT;
+}
+
+/**
+ * @brief Get the relation of a condition word.
+ * @return COND_* constant, or -1 if the word is not a relation.
+ */
+int condition_relation(char *word)
+{
+    char *words[] = {"is", "isnot", "lt", "le", "gt", "ge"}; //in the COND_* order
+
+    for(size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        if(!strcmp(word, words[i])) return (int)i;
+
+    return -1;
+}
+
+/**
+ * @brief Check a condition. 'is' and 'isnot' compare the printed texts of the operands (so 5 is not 5.0).
+ *        The other relations compare numbers (the texts of variables are parsed).
+ * @return 1 if the condition holds, 0 if it does not, or -1 on errors (the error is printed).
+ */
+int condition_holds(condition_t *cond)
+{
+    if((cond->left.slot != NULL && cond->left.slot->text == NULL) ||
+       (cond->right.slot != NULL && cond->right.slot->text == NULL))
+    {
+        command_error("ERROR: Variable not found in the condition\n");
+        return -1;
+    }
+
+    if(cond->relation == COND_IS || cond->relation == COND_ISNOT)
+        return (strcmp(operand_text(&cond->left), operand_text(&cond->right)) == 0) == (cond->relation == COND_IS);
+
+    value_t left, right;
+
+    if(!operand_number(&cond->left, &left) || !operand_number(&cond->right, &right))
+    {
+        command_error("ERROR: The operands of 'lt', 'le', 'gt' and 'ge' must be numbers\n");
+        return -1;
+    }
+
+    int order = compare_numbers(&left, &right);
+
+    switch(cond->relation)
+    {
+        case COND_LT: return order < 0;
+        case COND_LE: return order <= 0;
+        case COND_GT: return order > 0;
+        default: return order >= 0;
+    }
+}
+
+/**
+ * @brief Compile the condition arguments of an 'if' or 'while' header ([a] is [b] or [a] isnot [b]).
+ * @return Index of the condition in the program.
+ */
+size_t compile_condition(program_t *p, cmd_line_t *header)
+{
+    grow_array((void**)&p->conds, &p->cap_conds, p->n_conds, sizeof(condition_t));
+    condition_t *cond = &p->conds[p->n_conds];
+
+    if(header->n_tokens != 3 || condition_relation(header->tokens[1]) == -1)
+    {
+        command_error("ERROR: The \'%s\' condition syntax is: %s [a] is [b]\n"
+               "\tor: %s [a] isnot [b]\n"
+               "\tor: %s [a] lt|le|gt|ge [b] (numbers)\n",
+               header->command, header->command, header->command, header->command);
+        p->failed = 1;
+
+        cond->left = compile_operand(p, "");
+        cond->right = compile_operand(p, "");
+        cond->relation = COND_IS;
+    }
+    else
+    {
+        cond->left = compile_operand(p, header->tokens[0]);
+        cond->right = compile_operand(p, header->tokens[2]);
+        cond->relation = condition_relation(header->tokens[1]);
+    }
+
+    return p->n_conds++;
+}
+
+/**
+ * @brief Add a loop state to the program.
+ * @return Index of the loop in the program.
+ */
+size_t add_loop(program_t *p, alphabetical_tree_node_t *slot, operand_t *items, size_t n_items)
+{
+    grow_array((void**)&p->loops, &p->cap_loops, p->n_loops, sizeof(loop_t));
+
+    p->loops[p->n_loops].slot = slot;
+    p->loops[p->n_loops].items = items;
+    p->loops[p->n_loops].n_items = n_items;
+    p->loops[p->n_loops].counter = 0;
+    p->loops[p->n_loops].limit = 0;
 
-            printf("\n"); //break line
-        }
-    }
+    return p->n_loops++;
 }
 
 /**
- * @brief Treatment function of the LS command.
- * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ * @brief Check if a command token opens a block.
  */
-void ls_command(cmd_line_t *cmd_line)
+int block_keyword(char *command)
 {
-    assert(cmd_line != NULL);
+    return !strcmp(command, "for") || !strcmp(command, "while") ||
+           !strcmp(command, "if") || !strcmp(command, "repeat");
+}
 
-    char dir_name[MAX_TOKEN_LEN]; //buffer to working dir name
+#define BODY_NONE -1 //the line does not close the body
+#define BODY_END 0  //the body was closed by 'end'
+#define BODY_ELSE 1 //the body was closed by 'else'
 
-    // STEP 1 - GET THE PATH OF THE DIRECTORY THAT WILL BE LOAD
+void compile_block(program_t *p, cmd_line_t *header);
 
-    if(cmd_line->nargs > 1)
+/**
+ * @brief Compile a command line of a block body. The program takes the cmd_line buffer.
+ */
+void compile_line(program_t *p, cmd_line_t *cmd_line)
+{
+    if(block_keyword(cmd_line->command)) //nested block
     {
-        printf("ERROR: The ls command has 0 or 1 arguments\n");
-        print_cmd_line(cmd_line);
+        compile_block(p, cmd_line);
+        destroy_cmd_line(cmd_line);
         return;
     }
-    else if(cmd_line->nargs == 1)
-        strcpy(dir_name, cmd_line->args[0]);
-    else
-        syscall(SYS_getcwd, dir_name, MAX_TOKEN_LEN); //linux syscall 'getcwd' to get the current working dir name
 
-    // STEP 2 - LOAD THE DIRECTORY AS A DESCRIPTOR
+    if(!strcmp(cmd_line->command, "let")) //compiled expression
+    {
+        grow_array((void**)&p->lets, &p->cap_lets, p->n_lets, sizeof(let_t));
 
-    int fd = open(dir_name, O_RDONLY | O_DIRECTORY); //open the working dir as a file descriptor
+        if(compile_let(&p->lets[p->n_lets], cmd_line))
+            emit_instruction(p, OP_LET, p->n_lets++, 0);
+        else
+            p->failed = 1;
 
-    if(fd == -1) //file descriptor equal to -1 is an error flag
-    {
-        printf("ERROR: Cannot load that directory descriptor\n");
+        destroy_cmd_line(cmd_line);
         return;
     }
 
-    // STEP 3 - GET DIRECTORY ENTRIES FROM THE DESCRIPTOR AND PRINT ITS INFORMATIONS
+    alphabetical_tree_node_t *node = NULL;
 
-    void *buffer = malloc(DENTS_BUFFER_SIZE); //buffer to dir entries
-
-    long n_read = syscall(SYS_getdents, fd, buffer, DENTS_BUFFER_SIZE); //getdents syscall to get dir entries
+    if(alphabetical_string(cmd_line->command))
+        node = find_token_in_tree(dictionary, cmd_line->command);
 
-    //the 'getdents' syscall must be repeated as long as there are unread entries in the descriptor.
-    while(n_read != 0) //do it while the 'getdents' syscall gets most than zero entries
+    if(node == NULL || node->cmd_callback == NULL)
     {
-        if(n_read == -1) //n_read equal to -1 is an error flag
-        {
-            printf("ERROR: Cannot read entries of that directory\n");
-            return;
-        }
+        command_error("ERROR: Command \'%s\' not found\n", cmd_line->command);
+        p->failed = 1;
+        destroy_cmd_line(cmd_line);
+        return;
+    }
 
-        print_entries(buffer, n_read); //print entries informations
+    grow_array((void**)&p->calls, &p->cap_calls, p->n_calls, sizeof(call_t));
+    p->calls[p->n_calls].callback = node->cmd_callback;
+    p->calls[p->n_calls].cmd_line = cmd_line;
 
-        //repeat 'getdents' syscall to get remaining dir entries
-        n_read = syscall(SYS_getdents, fd, buffer, DENTS_BUFFER_SIZE);
-    }
+    emit_instruction(p, OP_CALL, p->n_calls++, 0);
 }
 
 /**
- * @brief Treatment function of the EXEC command.
- * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ * @brief Compile the commands of a body line. The '&&' and '||' operators become conditional jumps
+ *        over the next command. The program takes the cmd_line buffers of the list.
+ * @return BODY_END or BODY_ELSE if the line closes the body ('end' or 'else' as its last command), or BODY_NONE.
  */
-void exec_command(cmd_line_t *cmd_line)
+int compile_list(program_t *p, cmd_list_t *list)
 {
-    assert(cmd_line != NULL);
+    int op = LIST_END; //operator before the command
 
-    if(cmd_line->nargs < 1)
+    for(size_t i = 0; i < list->n_cmds; i++)
     {
-        printf("ERROR: The ls command has at least 1 argument\n");
-        print_cmd_line(cmd_line);
-        return;
-    }
+        cmd_line_t *cmd_line = list->cmds[i];
+        int next_op = cmd_line->next_op;
 
-    int my_pid = fork(); //fork the current process
+        if(!strcmp(cmd_line->command, "end") || !strcmp(cmd_line->command, "else"))
+        {
+            if(i+1 == list->n_cmds && (op == LIST_END || op == LIST_SEQ))
+                return strcmp(cmd_line->command, "end") ? BODY_ELSE : BODY_END;
 
-    if( my_pid == 0 ) //if this is the child process
-    {
-        //build the argv array
-        char **argv = (char**)calloc(cmd_line->nargs+1, sizeof(char*));
+            command_error("ERROR: \'%s\' must be the last command of its line (after \';\')\n", cmd_line->command);
+            p->failed = 1;
+            op = next_op;
+            continue;
+        }
 
-        for( int i = 0; i < cmd_line->nargs; i++ )
-            argv[i] = cmd_line->args[i];
+        size_t skip = 0;
+        int conditional = op == LIST_AND || op == LIST_OR;
 
-        argv[cmd_line->nargs] = NULL; //argv must be NULL-terminated
+        if(conditional)
+            skip = emit_instruction(p, op == LIST_AND ? OP_JUMP_FAILED : OP_JUMP_SUCCEEDED, 0, 0);
 
-        //change the current process to 'args[0]'
-        int ret_val = execv(cmd_line->args[0], argv);
+        list->cmds[i] = NULL; //taken by the program
+        compile_line(p, cmd_line);
 
-        if(ret_val == -1) //error flag
-        {
-            printf("ERROR: Cannot execute \'%s\'\n", cmd_line->args[0]);
-            exit(0);
-        }
+        if(conditional) p->code[skip].target = p->n_code;
+        op = next_op;
     }
 
-    wait(2);
+    return BODY_NONE;
 }
 
 /**
- * @brief Treatment function of the SET command.
- * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ * @brief Read and compile the lines of a block body until its 'end' (or 'else') line.
+ * @return BODY_END or BODY_ELSE.
  */
-void set_command(cmd_line_t *cmd_line)
+int compile_body(program_t *p)
 {
-    assert(cmd_line != NULL);
-    assert(variables != NULL);
-
-    if(cmd_line->nargs != 3)
+    while(1)
     {
-        printf("ERROR: The set command has 3 arguments\n");
-        print_cmd_line(cmd_line);
-        return;
-    }
+        cmd_list_t *list = create_cmd_list();
+        int status = read_input_cmd_list("... ", list);
 
-    char *dest_var = cmd_line->args[0]; //destination variable name
-    char *text = NULL; //text that will be stored in the variable
+        if(status != LINE_READ) //blank line, syntax error or end of input
+        {
+            destroy_cmd_list(list);
 
-    if(!alphabetical_string(dest_var))
-    {
-        printf("ERROR: Variable's names must have only alphabetical chars\n");
-        return;
-    }
+            if(status == LINE_ERROR) p->failed = 1;
 
-    if(!strcmp(cmd_line->args[1], "as")) // variable <- text
-    {
-        text = cmd_line->args[2];
+            if(status == LINE_END) //end of input before 'end'
+            {
+                command_error("ERROR: Missing \'end\'\n");
+                p->failed = 1;
+                return BODY_END;
+            }
+            continue;
+        }
+
+        int terminator = compile_list(p, list);
+        destroy_cmd_list(list);
+
+        if(terminator != BODY_NONE) return terminator;
     }
-    else if(!strcmp(cmd_line->args[1], "like")) // variable <- variable
+}
+
+/**
+ * @brief Compile a block (header line, body lines and 'end' line).
+ * @param p       Pointer to the program.
+ * @param header  Pointer to the cmd_line_t struct buffer of the header line (it is not taken by the program).
+ */
+void compile_block(program_t *p, cmd_line_t *header)
+{
+    if(!strcmp(header->command, "for")) // for [var] in [item] ... [item]
     {
-        char *origin_var = cmd_line->args[2];
+        alphabetical_tree_node_t *slot = NULL;
+        operand_t *items = NULL;
+        size_t n_items = 0;
 
-        if(!alphabetical_string(origin_var))
+        if(header->n_tokens < 2 || strcmp(header->tokens[1], "in") || !alphabetical_string(header->tokens[0]))
         {
-            printf("ERROR: Variable's names must have only alphabetical chars\n");
-            return;
+            command_error("ERROR: The \'for\' syntax is: for [varname] in [item] ... [item]\n");
+            p->failed = 1;
         }
+        else
+        {
+            size_t cap_items = 0;
+            slot = variable_slot(header->tokens[0]);
 
-        alphabetical_tree_node_t *n = find_token_in_tree(variables, origin_var);
-        text = n->text;
+            for(size_t i = 2; i < header->n_tokens; i++)
+            {
+                char *token = header->tokens[i];
+                size_t n_matches = 0;
+
+                if(token[0] != '$' && dynamic_token(token)) //glob pattern: the items are the paths matched now
+                {
+                    arg_storage_t matches = {0};
+                    struct glob_pattern *pattern = compile_glob_pattern(token);
+                    n_matches = glob_paths(pattern, &matches);
+
+                    for(size_t j = 0; j < n_matches; j++)
+                    {
+                        grow_array((void**)&items, &cap_items, n_items, sizeof(operand_t));
+                        items[n_items++] = compile_operand(p, &matches.data[matches.offsets[j]]);
+                    }
+
+                    destroy_glob_pattern(pattern);
+                    free(matches.data);
+                    free(matches.offsets);
+                }
+
+                if(n_matches == 0)
+                {
+                    grow_array((void**)&items, &cap_items, n_items, sizeof(operand_t));
+                    items[n_items++] = compile_operand(p, token);
+                }
+            }
+        }
+
+        size_t loop = add_loop(p, slot, items, n_items);
+        emit_instruction(p, OP_LOOP_INIT, loop, 0);
+        size_t next = emit_instruction(p, OP_FOR_NEXT, loop, 0);
+
+        if(compile_body(p) != BODY_END)
+        {
+            command_error("ERROR: \'else\' without \'if\'\n");
+            p->failed = 1;
+        }
+
+        emit_instruction(p, OP_JUMP, 0, next);
+        p->code[next].target = p->n_code;
     }
-    else
+    else if(!strcmp(header->command, "repeat")) // repeat [count]
     {
-        printf("ERROR: Missing \'as\' or \'like\' (lowercase) statement.\n"
-               "The syntax of \'store\' command is: set [var] as [text].\n"
-               "\tor: set [dest_var] like [origin_var]\n"
-               "Example: set dev_path as \\dev\n"
-               "Example: set dev_path_2 like dev_path\n"
-               );
-        return;
-    }
+        operand_t *count = (operand_t*)calloc(1, sizeof(operand_t));
+        assert(count != NULL);
 
-    insert_token_in_tree(variables, dest_var, NULL, text);
-}
+        if(header->n_tokens != 1)
+        {
+            command_error("ERROR: The \'repeat\' syntax is: repeat [count]\n");
+            p->failed = 1;
+            *count = compile_operand(p, "0");
+        }
+        else *count = compile_operand(p, header->tokens[0]);
 
-/**
- * @brief Treatment function of the PRINT command.
- * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
- */
-void print_command(cmd_line_t *cmd_line)
-{
-    assert(cmd_line != NULL);
+        size_t loop = add_loop(p, NULL, count, 1);
+        emit_instruction(p, OP_LOOP_INIT, loop, 0);
+        size_t next = emit_instruction(p, OP_REPEAT_NEXT, loop, 0);
 
-    if(cmd_line->nargs < 1)
-    {
-        printf("ERROR: The print command has at least 1 argument\n");
-        print_cmd_line(cmd_line);
-        return;
-    }
+        if(compile_body(p) != BODY_END)
+        {
+            command_error("ERROR: \'else\' without \'if\'\n");
+            p->failed = 1;
+        }
 
-    for(int i = 0; i < cmd_line->nargs; i++)
+        emit_instruction(p, OP_JUMP, 0, next);
+        p->code[next].target = p->n_code;
+    }
+    else if(!strcmp(header->command, "while")) // while [a] is/isnot [b]
     {
-        if(cmd_line->args[i][0] == '$' && cmd_line->args[i][1] != '$') //arg is a variable name
+        size_t cond = compile_condition(p, header);
+        size_t test = emit_instruction(p, OP_JUMP_UNLESS, cond, 0);
+
+        if(compile_body(p) != BODY_END)
         {
-            char *var_name = &cmd_line->args[i][1];
+            command_error("ERROR: \'else\' without \'if\'\n");
+            p->failed = 1;
+        }
 
-            if(!alphabetical_string(var_name))
-            {
-                printf("ERROR: Variable's names have only alphabetical chars\n");
-                return;
-            }
+        emit_instruction(p, OP_JUMP, 0, test);
+        p->code[test].target = p->n_code;
+    }
+    else // if [a] is/isnot [b]
+    {
+        size_t cond = compile_condition(p, header);
+        size_t test = emit_instruction(p, OP_JUMP_UNLESS, cond, 0);
 
-            alphabetical_tree_node_t *n = find_token_in_tree(variables, var_name);
+        if(compile_body(p) == BODY_ELSE)
+        {
+            size_t skip_else = emit_instruction(p, OP_JUMP, 0, 0);
+            p->code[test].target = p->n_code;
 
-            if(n == NULL)
+            if(compile_body(p) != BODY_END)
             {
-                printf("\nERROR: Variable \'%s\' not found\n", var_name);
-                return;
+                command_error("ERROR: \'if\' has only one \'else\'\n");
+                p->failed = 1;
             }
 
-            printf("%s ", n->text);
+            p->code[skip_else].target = p->n_code;
         }
-        else if(cmd_line->args[i][0] == '$' && cmd_line->args[i][1] == '$') //arg begins with '$' but is not a variable name
-            printf("%s ", &cmd_line->args[i][1]);
-        else
-            printf("%s ", cmd_line->args[i]);
+        else p->code[test].target = p->n_code;
     }
-    printf("\n");
 }
 
 /**
- * @brief Treatment function of the UV command.
- * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
+ * @brief Free the program with its tables and cmd_line buffers.
  */
-void uv_command(cmd_line_t *cmd_line)
+void destroy_program(program_t *p)
 {
-    assert(cmd_line != NULL);
+    assert(p != NULL);
 
-    if(cmd_line->nargs < 2)
+    for(size_t i = 0; i < p->n_calls; i++)
+        destroy_cmd_line(p->calls[i].cmd_line);
+
+    for(size_t i = 0; i < p->n_lets; i++)
+        destroy_let(&p->lets[i]);
+
+    for(size_t i = 0; i < p->n_conds; i++)
     {
-        printf("ERROR: The uv command has at least 2 arguments\n");
-        print_cmd_line(cmd_line);
-        return;
+        free(p->conds[i].left.literal);
+        free(p->conds[i].right.literal);
     }
 
-    cmd_line_t *new_cmd_line = create_cmd_line();
-    set_cmd_line_command(new_cmd_line, cmd_line->args[0]);
-    init_cmd_line_args(new_cmd_line, cmd_line->nargs-1);
+    for(size_t i = 0; i < p->n_loops; i++)
+    {
+        if(p->loops[i].items == NULL) continue;
 
-    for(int i = 1; i < cmd_line->nargs; i++)
+        for(size_t j = 0; j < p->loops[i].n_items; j++)
+            free(p->loops[i].items[j].literal);
+        free(p->loops[i].items);
+    }
+
+    free(p->code);
+    free(p->calls);
+    free(p->lets);
+    free(p->conds);
+    free(p->loops);
+    free(p);
+}
+
+/**
+ * @brief Run a compiled program.
+ * @param p  Pointer to the program.
+ */
+void run_program(program_t *p)
+{
+    assert(p != NULL);
+
+    size_t pc = 0; //program counter
+
+    while(1)
     {
-        if(cmd_line->args[i][0] == '$' && cmd_line->args[i][1] != '$') //arg is a variable name
+        instruction_t *instr = &p->code[pc++];
+
+        switch(instr->op)
         {
-            char *var_name = &cmd_line->args[i][1];
+            case OP_CALL:
+            {
+                call_t *call = &p->calls[instr->arg];
+
+                //the variable slots of the line are kept between iterations
+                if(unexpanded_command(call->cmd_line->command) || expand_cmd_line(call->cmd_line))
+                    call_command(call->callback, call->cmd_line);
+                break;
+            }
+
+            case OP_LET:
+                run_let(&p->lets[instr->arg]);
+                break;
 
-            if(!alphabetical_string(var_name))
+            case OP_JUMP:
+                pc = instr->target;
+                break;
+
+            case OP_JUMP_UNLESS:
             {
-                printf("ERROR: Variable's names have only alphabetical chars\n");
-                return;
+                int holds = condition_holds(&p->conds[instr->arg]);
+
+                if(holds == -1) return;
+                if(!holds) pc = instr->target;
+                break;
             }
 
-            alphabetical_tree_node_t *n = find_token_in_tree(variables, var_name);
+            case OP_JUMP_FAILED:
+                if(last_status != 0) pc = instr->target;
+                break;
+
+            case OP_JUMP_SUCCEEDED:
+                if(last_status == 0) pc = instr->target;
+                break;
 
-            if(n == NULL)
+            case OP_LOOP_INIT:
             {
-                printf("\nERROR: Variable \'%s\' not found\n", var_name);
-                return;
+                loop_t *loop = &p->loops[instr->arg];
+                loop->counter = 0;
+
+                if(loop->slot == NULL) //'repeat' loops read their count at the beginning
+                {
+                    value_t count;
+
+                    if(!operand_number(&loop->items[0], &count) || count.type != VALUE_INT || count.integer < 0)
+                    {
+                        command_error("ERROR: The \'repeat\' count must be a number\n");
+                        return;
+                    }
+
+                    loop->limit = count.integer;
+                }
+                break;
+            }
+
+            case OP_FOR_NEXT:
+            {
+                loop_t *loop = &p->loops[instr->arg];
+
+                if(loop->counter == loop->n_items) //no more items
+                {
+                    pc = instr->target;
+                    break;
+                }
+
+                char *item = operand_text(&loop->items[loop->counter++]);
+
+                if(item == NULL)
+                {
+                    command_error("ERROR: Variable not found in the \'for\' items\n");
+                    return;
+                }
+
+                assign_variable(loop->slot, item);
+                break;
+            }
+
+            case OP_REPEAT_NEXT:
+            {
+                loop_t *loop = &p->loops[instr->arg];
+
+                if(loop->counter == loop->limit) pc = instr->target;
+                else loop->counter++;
+                break;
             }
 
-            set_cmd_line_arg(new_cmd_line, n->text, i-1);
+            case OP_HALT:
+                return;
         }
-        else if(cmd_line->args[i][0] == '$' && cmd_line->args[i][1] == '$') //arg begins with '$' but is not a variable name
-            set_cmd_line_arg(new_cmd_line, &cmd_line->args[i][1], i-1);
-        else
-            set_cmd_line_arg(new_cmd_line, cmd_line->args[i], i-1);
     }
+}
 
-    run_command(dictionary, new_cmd_line);
-    destroy_cmd_line(new_cmd_line);
+/**
+ * @brief Treatment function of the FOR, WHILE, IF and REPEAT commands.
+ *        Reads the block until its 'end' line, compiles it and runs it.
+ * @param cmd_line  Pointer to the cmd_line_t struct buffer with the block header.
+ */
+void block_command(cmd_line_t *cmd_line)
+{
+    assert(cmd_line != NULL);
+
+    program_t *p = (program_t*)calloc(1, sizeof(program_t));
+    assert(p != NULL);
+
+    compile_block(p, cmd_line);
+    emit_instruction(p, OP_HALT, 0, 0);
+
+    if(p->failed)
+        command_error("ERROR: The block has not been executed\n");
+    else
+        run_program(p);
 
+    destroy_program(p);
 }
 
 /**
- * @brief Print text content for each node in the alphabetical subtree
- * @param node  Pointer to the root of the alphabetical subtree
+ * @brief Read a block skipped by '&&' or '||' until its 'end' line, without running it.
+ * @param header  Pointer to the cmd_line_t struct buffer with the block header.
  */
-void print_subtree_texts(alphabetical_tree_node_t *node)
+void skip_block(cmd_line_t *header)
 {
-    if(node != NULL)
-    {
-        if(node->text != NULL) printf("%s\n", node->text);
+    assert(header != NULL);
 
-        for(int i = 0; i < ALPHABETICAL_TREE_ENTRIES; i++)
-            print_subtree_texts(node->next[i]);
-    }
+    program_t *p = (program_t*)calloc(1, sizeof(program_t));
+    assert(p != NULL);
+
+    compile_block(p, header);
+    destroy_program(p);
 }
 
 /**
- * @brief Treatment function of the HELP command.
+ * @brief Treatment function of the END and ELSE commands outside of a block.
  * @param cmd_line  Pointer to the cmd_line_t struct buffer with the command token and its arguments.
  */
-void help_command(cmd_line_t *cmd_line)
+void block_end_command(cmd_line_t *cmd_line)
 {
     assert(cmd_line != NULL);
 
-    if(cmd_line->nargs != 0)
-        printf("WARNING: The \'help\' command has no arguments\n\n");
-
-    printf("Command line syntax:\n"
-           "* No arguments:\t\t[command]\n"
-           "* Single argument:\t[command] [arg]\n"
-           "* N arguments:\t\t[command] [arg_0] [arg_1] ... [arg_{N-1}]\n"
-           "\n"
-           "---- COMMANDS ----\n\n"
-           );
-
-    for(int i = 0; i < ALPHABETICAL_TREE_ENTRIES; i++)
-    {
-        print_subtree_texts(dictionary->entries[i]);
-    }
+    command_error("ERROR: \'%s\' without a block\n", cmd_line->command);
 }
 
 
@@ -935,8 +7755,11 @@ void help_command(cmd_line_t *cmd_line)
 // =============== MAIN FUNCTION ===============
 // =============================================
 
-int main()
+#ifndef SMALL_SHELL_NO_MAIN
+
+int main(int argc, char **argv)
 {
+    check_warm_zygote(argc, argv); //(this process can be the zygote of the warm pool)
 
     printf("Small Linux Shell\n"
            "By Filipe Chagas\n"
@@ -946,6 +7769,10 @@ int main()
 
     //Building variables tree
     variables = create_alphabetical_tree();
+    import_environment(environ);
+
+    //Opening the history file
+    open_history();
 
     //Building the dictionary of commands
     dictionary = create_alphabetical_tree();
@@ -964,8 +7791,8 @@ int main()
 
     insert_token_in_tree(dictionary, "exit", exit_command,
                          "* EXIT\n"
-                         "\tArguments: no arguments.\n"
-                         "\tDescription: Close the shell.\n"
+                         "\tArguments: status (optional, 0 by default).\n"
+                         "\tDescription: Close the shell with the exit status.\n"
                          );
 
     insert_token_in_tree(dictionary, "ls", ls_command,
@@ -974,13 +7801,53 @@ int main()
                          "\tDescription: Lists entries in the directory (argument directory or working directory).\n"
                          );
 
+    insert_token_in_tree(dictionary, "lscache", lscache_command,
+                         "* LSCACHE\n"
+                         "\tArguments: on or off (optional).\n"
+                         "\tDescription: Make \'ls\' keep the listings in memory (updated by inotify events) or read the disk.\n"
+                         "\t\t Without arguments, print the cache statistics.\n"
+                         );
+
     insert_token_in_tree(dictionary, "exec", exec_command,
                          "* EXEC (Execute) \n"
-                         "\tArguments: path, arg0, arg1, ..., argn.\n"
+                         "\tArguments: options (optional), path, arg0, arg1, ..., argn.\n"
                          "\tDescription: Execute the *path* file.\n"
+                         "\tOptions: --cpus LIST      run on the CPUs of the list (e.g. 4-7)\n"
+                         "\t\t --nice N         nice value (-20 to 19)\n"
+                         "\t\t --sched POLICY   batch, idle or other\n"
+                         "\t\t --cpumax QUOTA[/PERIOD]  cgroup v2 cpu.max quota in microseconds (the shell must run in\n"
+                         "\t\t                           the root or a delegated cgroup, or have write access to its parent)\n"
                          "\n"
                          );
 
+    insert_token_in_tree(dictionary, "warm", warm_command,
+                         "* WARM\n"
+                         "\tArguments: path, count (optional, 2 by default)\n"
+                         "\tDescription: Keep count processes forked in advance to launch the *path* file with \'exec\'.\n"
+                         "\t\t A count of 0 stops warming the file. Without arguments, print the pool and its hit rates.\n"
+                         );
+
+    insert_token_in_tree(dictionary, "watch", watch_command,
+                         "* WATCH\n"
+                         "\tArguments: -n seconds (optional, 2 by default), -c count (optional), command, arg0, ..., argn\n"
+                         "\tDescription: Run the command every *seconds* and show its output, redrawing the lines that changed.\n"
+                         "\t\t Without -c, it runs until \'q\' is pressed.\n"
+                         );
+
+    insert_token_in_tree(dictionary, "cat", cat_command,
+                         "* CAT (Concatenate)\n"
+                         "\tArguments: path, ... (n-times) (optional)\n"
+                         "\tDescription: Print the contents of the files (or of the input, without paths).\n"
+                         "\t\t Use '>', '>>', '<' and '2>' to redirect the streams of any command.\n"
+                         );
+
+    insert_token_in_tree(dictionary, "affinity", affinity_command,
+                         "* AFFINITY\n"
+                         "\tArguments: CPU list (optional), e.g. 0-3,6\n"
+                         "\tDescription: Restrict the shell (and the programs it executes) to the CPUs of the list.\n"
+                         "\t\t Without arguments, print the CPUs of the shell.\n"
+                         );
+
     insert_token_in_tree(dictionary, "help", help_command,
                          "* HELP\n"
                          "\tArguments: no arguments.\n"
@@ -995,6 +7862,30 @@ int main()
                          "\t\t With \'like\', copy contents from the origin var to the destination var.\n"
                          );
 
+    insert_token_in_tree(dictionary, "let", let_command,
+                         "* LET\n"
+                         "\tArguments: varname, =, expression\n"
+                         "\t\t varname, =, substring, varname, start, count (optional)\n"
+                         "\tDescription: Set the result of the expression as variable's content. The expression has numbers,\n"
+                         "\t\t variables (with or without '$'), 'length varname', + - * / % and parentheses (separated by spaces).\n"
+                         "\t\t Numbers are kept in binary (integers or floats) and written as texts only when they are used.\n"
+                         "\t\t With 'substring', set the chars of the variable from start (0 is the first one).\n"
+                         );
+
+    insert_token_in_tree(dictionary, "split", split_command,
+                         "* SPLIT\n"
+                         "\tArguments: $varname or text, by, separator, into, varname, ... (n-times)\n"
+                         "\tDescription: Set the pieces of the text between separators as the contents of the variables\n"
+                         "\t\t (the last variable gets the rest of the text).\n"
+                         );
+
+    insert_token_in_tree(dictionary, "export", export_command,
+                         "* EXPORT\n"
+                         "\tArguments: varname, ... (n-times) (optional)\n"
+                         "\tDescription: Give the variables to the programs executed by \'exec\' (the name keeps the typed case).\n"
+                         "\t\t Without arguments, print the environment of the programs.\n"
+                         );
+
     insert_token_in_tree(dictionary, "print", print_command,
                          "* PRINT\n"
                          "\tArguments: $varname or text, ... (n-times)\n"
@@ -1007,23 +7898,84 @@ int main()
                          "\tDescription: Use any command with variables.\n"
                          );
 
+    insert_token_in_tree(dictionary, "save", save_command,
+                         "* SAVE\n"
+                         "\tArguments: path\n"
+                         "\tDescription: Write the variables and the working directory to a state image file.\n"
+                         );
+
+    insert_token_in_tree(dictionary, "load", load_command,
+                         "* LOAD\n"
+                         "\tArguments: path\n"
+                         "\tDescription: Restore the variables and the working directory of a state image file.\n"
+                         "\t\t The image is mapped: each variable is looked up in it when it is first used.\n"
+                         );
+
+    insert_token_in_tree(dictionary, "history", history_command,
+                         "* HISTORY\n"
+                         "\tArguments: count (optional)\n"
+                         "\t\t -s, pattern\n"
+                         "\t\t -p, prefix\n"
+                         "\tDescription: Print the last count lines typed (all of them without count), the lines that\n"
+                         "\t\t contain the pattern (-s) or the lines that begin with the prefix (-p).\n"
+                         "\t\t Use the up and down arrows to recall lines.\n"
+                         );
+
+    insert_token_in_tree(dictionary, "for", block_command,
+                         "* FOR ... END\n"
+                         "\tArguments: varname, in, $varname or text, ... (n-times)\n"
+                         "\tDescription: Run the following lines (until \'end\') once for each item, with the item in the variable.\n"
+                         );
+
+    insert_token_in_tree(dictionary, "while", block_command,
+                         "* WHILE ... END\n"
+                         "\tArguments: $varname or text, is, isnot, lt, le, gt or ge, $varname or text\n"
+                         "\tDescription: Run the following lines (until \'end\') while the condition holds.\n"
+                         );
+
+    insert_token_in_tree(dictionary, "if", block_command,
+                         "* IF ... [ELSE ...] END\n"
+                         "\tArguments: $varname or text, is, isnot, lt, le, gt or ge, $varname or text\n"
+                         "\tDescription: Run the following lines if the condition holds (or the lines after \'else\' if not).\n"
+                         );
+
+    insert_token_in_tree(dictionary, "repeat", block_command,
+                         "* REPEAT ... END\n"
+                         "\tArguments: count ($varname or number)\n"
+                         "\tDescription: Run the following lines (until \'end\') count times.\n"
+                         );
+
+    insert_token_in_tree(dictionary, "end", block_end_command, NULL);
+    insert_token_in_tree(dictionary, "else", block_end_command, NULL);
+
     //Runtime loop
-    cmd_line_t *cmd_line;
+    cmd_list_t *cmd_list;
     while (1)
     {
-        cmd_line = create_cmd_line(); //new command line buffer
+        reap_warm_helpers(); //helpers that exited since the last command line
 
-        printf(">>> ");
+        cmd_list = create_cmd_list(); //new command list buffer
 
-        read_cmd_line(cmd_line); //read command line
+        int status = read_input_cmd_list(">>> ", cmd_list); //read and parse the command line once
+
+        if(status != LINE_READ) //Ignore empty command line (and syntax errors)
+        {
+            destroy_cmd_list(cmd_list);
 
-        if(strlen(cmd_line->command) == 0) continue; //Ignore empty command line
+            if(status == LINE_END) //end of input
+            {
+                printf("\n");
+                break;
+            }
+            continue;
+        }
 
-        run_command(dictionary, cmd_line); //run command line
+        run_cmd_list(dictionary, cmd_list); //run the commands of the line
 
-        destroy_cmd_line(cmd_line); //discard command line buffer
+        destroy_cmd_list(cmd_list); //discard command list buffer
     }
 
-    return 0;
+    return last_status; //exit status of the last command
 }
 
+#endif //SMALL_SHELL_NO_MAIN
@@ -0,0 +1,489 @@
+/*
+ * SMALL LINUX SHELL - MICROBENCHMARKS
+ *
+ * Times the shell internals (alphabetical tree, small lexer, cmd_line_t object, variable expansion, arithmetic,
+ * state images and warm pool)
+ * without the interactive loop. The shell source is included with its main function
+ * disabled, so this file always measures the same code that 'main.c' builds.
+ *
+ * Build:  gcc -O2 src/tools/bench.c -o bin/bench -pthread
+ * Run:    ./bin/bench
+ *
+ * Cache-miss counts are read with the 'perf_event_open' syscall. When the kernel
+ * does not allow it (e.g. perf_event_paranoid or containers), they are shown as 'n/a'.
+ */
+
+#define SMALL_SHELL_NO_MAIN
+#include "../main.c"
+
+#include <time.h> //contains 'clock_gettime'
+#include <sys/ioctl.h> //contains 'ioctl'
+#include <linux/perf_event.h> //contains perf_event_open constants
+
+#define BENCH_KEYS 100000 //Number of distinct keys in each tree benchmark
+#define BENCH_LOOKUPS 2000000 //Number of lookups in each lookup benchmark
+#define BENCH_LINES 200000 //Number of lines in the tokenizer and allocation benchmarks
+#define BENCH_IMAGE_VARS 5000 //Number of variables in the state image benchmark
+#define BENCH_IMAGE_ROUNDS 20 //Number of restores in the state image benchmark
+#define BENCH_LAUNCHES 500 //Number of program launches in the warm pool benchmark
+#define BENCH_WARM_BALLAST (256*1024*1024) //Memory of the shell in the warm pool benchmark (caches, images, ...)
+
+// ==================================================
+// =============== MEASUREMENT TOOLS ================
+// ==================================================
+
+/**
+ * @brief Timer and cache-miss counter of a benchmark section.
+ * @param start_ns   Monotonic time at the start of the section.
+ * @param perf_fd    perf_event descriptor counting cache misses (-1 if unavailable).
+ */
+typedef struct
+{
+    double start_ns;
+    int perf_fd;
+} bench_probe_t;
+
+/**
+ * @brief Get the monotonic clock in nanoseconds.
+ */
+double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief Open a hardware cache-miss counter for the calling thread.
+ * @return The perf_event descriptor, or -1 if it is not available.
+ */
+int open_cache_miss_counter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0); //linux syscall 'perf_event_open'
+}
+
+/**
+ * @brief Start a benchmark section.
+ * @param probe  Pointer to the probe of the section.
+ */
+void probe_start(bench_probe_t *probe)
+{
+    assert(probe != NULL);
+
+    probe->perf_fd = open_cache_miss_counter();
+
+    if(probe->perf_fd != -1)
+    {
+        ioctl(probe->perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(probe->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    probe->start_ns = now_ns();
+}
+
+/**
+ * @brief Stop a benchmark section and print its results.
+ * @param probe   Pointer to the probe of the section.
+ * @param name    Name of the section.
+ * @param ops     Number of operations performed in the section.
+ * @param bytes   Number of bytes processed in the section (0 if it is not relevant).
+ */
+void probe_stop(bench_probe_t *probe, char *name, size_t ops, size_t bytes)
+{
+    assert(probe != NULL);
+
+    double elapsed_ns = now_ns() - probe->start_ns;
+    long long misses = -1;
+
+    if(probe->perf_fd != -1)
+    {
+        ioctl(probe->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(probe->perf_fd, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+        close(probe->perf_fd);
+    }
+
+    printf("%-28s %12.0f ops/s %9.1f ns/op", name, ops / (elapsed_ns / 1e9), elapsed_ns / ops);
+
+    if(bytes > 0)
+        printf(" %9.1f MB/s", bytes / (elapsed_ns / 1e9) / 1e6);
+    else
+        printf("%15s", "");
+
+    if(misses >= 0)
+        printf(" %8.3f misses/op\n", (double)misses / ops);
+    else
+        printf(" %14s\n", "misses n/a");
+}
+
+/**
+ * @brief Fill a string with random lowercase letters.
+ * @param str   Buffer with room for len+1 chars.
+ * @param len   Number of letters.
+ */
+void random_key(char *str, size_t len)
+{
+    for(size_t i = 0; i < len; i++)
+        str[i] = 'a' + rand() % ALPHABETICAL_TREE_ENTRIES;
+
+    str[len] = '\0';
+}
+
+// ===============================================
+// =============== TREE BENCHMARKS ===============
+// ===============================================
+
+/**
+ * @brief Measure insertion and lookups per second in the alphabetical tree for keys of a given length.
+ * @param key_len   Length of each key.
+ */
+void bench_tree(size_t key_len)
+{
+    char *keys = (char*)malloc(BENCH_KEYS * (key_len+1));
+    assert(keys != NULL);
+
+    for(size_t i = 0; i < BENCH_KEYS; i++)
+        random_key(&keys[i * (key_len+1)], key_len);
+
+    alphabetical_tree_header_t *h = create_alphabetical_tree();
+    bench_probe_t probe;
+    char name[64];
+
+    //insert throughput (with a text, like the SET command does)
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_KEYS; i++)
+        insert_token_in_tree(h, &keys[i * (key_len+1)], NULL, "value");
+    sprintf(name, "insert (len %zu)", key_len);
+    probe_stop(&probe, name, BENCH_KEYS, 0);
+
+    //lookups in random order
+    size_t found = 0;
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_LOOKUPS; i++)
+        found += find_token_in_tree(h, &keys[(rand() % BENCH_KEYS) * (key_len+1)]) != NULL;
+    sprintf(name, "lookup (len %zu)", key_len);
+    probe_stop(&probe, name, BENCH_LOOKUPS, 0);
+
+    assert(found == BENCH_LOOKUPS);
+
+    free(keys); //the tree is kept alive, because the shell has no tree destructor
+}
+
+// ================================================
+// =============== LEXER BENCHMARKS ===============
+// ================================================
+
+/**
+ * @brief Build a text with BENCH_LINES command lines.
+ * @param len   Pointer to where the text length will be stored.
+ * @return The text buffer.
+ */
+char *build_script(size_t *len)
+{
+    const char *lines[] = {
+        "print hello world\n",
+        "set homedir as /home/user\n",
+        "exec /bin/echo one two three four five\n",
+        "ls\n",
+        "uv cd $homedir\n",
+    };
+    size_t n_lines = sizeof(lines) / sizeof(lines[0]);
+
+    size_t cap = BENCH_LINES * 64;
+    char *text = (char*)malloc(cap);
+    assert(text != NULL);
+
+    *len = 0;
+    for(size_t i = 0; i < BENCH_LINES; i++)
+    {
+        size_t l = strlen(lines[i % n_lines]);
+        assert(*len + l < cap);
+        memcpy(&text[*len], lines[i % n_lines], l);
+        *len += l;
+    }
+
+    return text;
+}
+
+/**
+ * @brief Measure tokenizer throughput of 'read_cmd_line' over an in-memory script.
+ */
+void bench_tokenizer()
+{
+    size_t len;
+    char *text = build_script(&len);
+
+    FILE *in = fmemopen(text, len, "r");
+    assert(in != NULL);
+
+    bench_probe_t probe;
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_LINES; i++)
+    {
+        cmd_line_t *cmd_line = create_cmd_line();
+        read_cmd_line(in, cmd_line);
+        destroy_cmd_line(cmd_line);
+    }
+    probe_stop(&probe, "tokenize (read_cmd_line)", BENCH_LINES, len);
+
+    fclose(in);
+    free(text);
+}
+
+/**
+ * @brief Measure the allocation cost of building and destroying one cmd_line_t per line.
+ */
+void bench_cmd_line_alloc()
+{
+    bench_probe_t probe;
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_LINES; i++)
+    {
+        cmd_line_t *cmd_line = create_cmd_line();
+        set_cmd_line_command(cmd_line, "exec");
+        init_cmd_line_args(cmd_line, 4);
+        set_cmd_line_arg(cmd_line, "/bin/echo", 0);
+        set_cmd_line_arg(cmd_line, "one", 1);
+        set_cmd_line_arg(cmd_line, "two", 2);
+        set_cmd_line_arg(cmd_line, "three", 3);
+        destroy_cmd_line(cmd_line);
+    }
+    probe_stop(&probe, "cmd_line_t alloc (4 args)", BENCH_LINES, 0);
+}
+
+/**
+ * @brief Measure the variable expansion of a cmd_line_t with 4 '$varname' args,
+ *        with the variables unchanged (cached views) and changed before each expansion.
+ */
+void bench_expansion()
+{
+    variables = create_alphabetical_tree();
+    alphabetical_tree_node_t *counter = variable_slot("counter");
+    assign_variable(counter, "0");
+    assign_variable(variable_slot("homedirectory"), "/home/user");
+    assign_variable(variable_slot("name"), "Filipe");
+
+    cmd_line_t *cmd_line = create_cmd_line();
+    set_cmd_line_command(cmd_line, "print");
+    init_cmd_line_args(cmd_line, 4);
+    set_cmd_line_arg(cmd_line, "$homedirectory", 0);
+    set_cmd_line_arg(cmd_line, "$name", 1);
+    set_cmd_line_arg(cmd_line, "$counter", 2);
+    set_cmd_line_arg(cmd_line, "text", 3);
+
+    bench_probe_t probe;
+    size_t expanded = 0;
+
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_LOOKUPS; i++)
+        expanded += expand_cmd_line(cmd_line);
+    probe_stop(&probe, "expand (unchanged vars)", BENCH_LOOKUPS, 0);
+
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_LINES; i++)
+    {
+        assign_variable(counter, "1");
+        expanded += expand_cmd_line(cmd_line);
+    }
+    probe_stop(&probe, "assign + expand", BENCH_LINES, 0);
+
+    assert(expanded == BENCH_LOOKUPS + BENCH_LINES);
+    destroy_cmd_line(cmd_line);
+}
+
+/**
+ * @brief Measure a counter updated by a compiled 'let counter = counter + 1' line (binary integer),
+ *        and the same counter kept as a text (parsed and written on each update).
+ */
+void bench_let()
+{
+    variables = create_alphabetical_tree();
+    alphabetical_tree_node_t *counter = variable_slot("counter");
+
+    cmd_line_t *cmd_line = create_cmd_line();
+    set_cmd_line_command(cmd_line, "let");
+    init_cmd_line_args(cmd_line, 5);
+    set_cmd_line_arg(cmd_line, "counter", 0);
+    set_cmd_line_arg(cmd_line, "=", 1);
+    set_cmd_line_arg(cmd_line, "counter", 2);
+    set_cmd_line_arg(cmd_line, "+", 3);
+    set_cmd_line_arg(cmd_line, "1", 4);
+
+    let_t let;
+    int compiled = compile_let(&let, cmd_line);
+    assert(compiled);
+
+    bench_probe_t probe;
+
+    assign_variable(counter, "0");
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_LOOKUPS; i++)
+        run_let(&let);
+    probe_stop(&probe, "let counter + 1 (binary)", BENCH_LOOKUPS, 0);
+
+    assert(!strcmp(variable_text(counter), "2000000"));
+
+    assign_variable(counter, "0");
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        char text[NUMBER_TEXT_LEN];
+        snprintf(text, sizeof(text), "%lld", strtoll(counter->text, NULL, 10) + 1);
+        assign_variable(counter, text);
+    }
+    probe_stop(&probe, "counter + 1 (text round trip)", BENCH_LOOKUPS, 0);
+
+    destroy_let(&let);
+    destroy_cmd_line(cmd_line);
+}
+
+/**
+ * @brief Start again from an empty variables tree without loaded images, as a new shell.
+ *        The old trees are kept alive (no tree destructor), but they are not used anymore.
+ */
+void reset_variables()
+{
+    for(size_t i = 0; i < n_images; i++)
+    {
+        munmap(images[i]->data, images[i]->size);
+        free(images[i]->detached);
+        free(images[i]);
+    }
+
+    for(size_t i = 0; i < n_detached; i++)
+        free(detached[i].name);
+
+    n_images = 0;
+    n_detached = 0;
+    variables = create_alphabetical_tree();
+}
+
+/**
+ * @brief Measure restoring BENCH_IMAGE_VARS variables into an empty tree, by replaying assignments
+ *        (as a script of 'set' lines does) and by loading a state image.
+ */
+void bench_image()
+{
+    char image_path[] = "/tmp/small_shell_bench.img";
+    char *names = (char*)malloc(BENCH_IMAGE_VARS * 9);
+    assert(names != NULL);
+
+    for(size_t i = 0; i < BENCH_IMAGE_VARS; i++)
+        random_key(&names[i * 9], 8);
+
+    bench_probe_t probe;
+
+    probe_start(&probe);
+    for(size_t r = 0; r < BENCH_IMAGE_ROUNDS; r++)
+    {
+        reset_variables();
+        for(size_t i = 0; i < BENCH_IMAGE_VARS; i++)
+            assign_variable(variable_slot(&names[i * 9]), "/home/user/some/value");
+    }
+    probe_stop(&probe, "restore by assignments", BENCH_IMAGE_ROUNDS * BENCH_IMAGE_VARS, 0);
+
+    save_state_image(image_path);
+
+    probe_start(&probe);
+    for(size_t r = 0; r < BENCH_IMAGE_ROUNDS; r++)
+    {
+        reset_variables();
+        load_state_image(image_path);
+    }
+    probe_stop(&probe, "restore by load (image)", BENCH_IMAGE_ROUNDS * BENCH_IMAGE_VARS, 0);
+
+    //the variables of an image are looked up when they are used
+    size_t found = 0;
+    probe_start(&probe);
+    for(size_t r = 0; r < BENCH_IMAGE_ROUNDS; r++)
+    {
+        reset_variables();
+        load_state_image(image_path);
+
+        for(size_t i = 0; i < BENCH_IMAGE_VARS; i++)
+            found += find_variable(&names[i * 9]) != NULL;
+    }
+    probe_stop(&probe, "load + use every variable", BENCH_IMAGE_ROUNDS * BENCH_IMAGE_VARS, 0);
+
+    assert(found == BENCH_IMAGE_ROUNDS * BENCH_IMAGE_VARS);
+
+    unlink(image_path);
+    free(names);
+}
+
+/**
+ * @brief Measure launching /bin/true with EXEC by forking the shell and through the helpers of the warm pool.
+ *        The shell holds BENCH_WARM_BALLAST bytes of touched memory, whose page tables each fork copies.
+ */
+void bench_warm()
+{
+    char *ballast = (char*)malloc(BENCH_WARM_BALLAST);
+    assert(ballast != NULL);
+    memset(ballast, 1, BENCH_WARM_BALLAST);
+
+    cmd_line_t *exec_line = create_cmd_line();
+    set_cmd_line_command(exec_line, "exec");
+    init_cmd_line_args(exec_line, 1);
+    set_cmd_line_arg(exec_line, "/bin/true", 0);
+
+    cmd_line_t *warm_line = create_cmd_line();
+    set_cmd_line_command(warm_line, "warm");
+    init_cmd_line_args(warm_line, 2);
+    set_cmd_line_arg(warm_line, "/bin/true", 0);
+    set_cmd_line_arg(warm_line, "2", 1);
+
+    bench_probe_t probe;
+
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_LAUNCHES; i++)
+        exec_command(exec_line);
+    probe_stop(&probe, "exec /bin/true (fork)", BENCH_LAUNCHES, 0);
+
+    warm_command(warm_line);
+
+    probe_start(&probe);
+    for(size_t i = 0; i < BENCH_LAUNCHES; i++)
+        exec_command(exec_line);
+    probe_stop(&probe, "exec /bin/true (warm)", BENCH_LAUNCHES, 0);
+
+    set_cmd_line_arg(warm_line, "0", 1); //stop warming
+    warm_command(warm_line);
+
+    destroy_cmd_line(exec_line);
+    destroy_cmd_line(warm_line);
+    free(ballast);
+}
+
+// =============================================
+// =============== MAIN FUNCTION ===============
+// =============================================
+
+int main(int argc, char **argv)
+{
+    check_warm_zygote(argc, argv); //the warm pool benchmark executes this binary as its zygote
+    srand(1234); //fixed seed, so runs are comparable
+
+    printf("Small Linux Shell - microbenchmarks\n\n");
+
+    size_t key_lens[] = {1, 2, 4, 8, 16, 32};
+    for(size_t i = 0; i < sizeof(key_lens) / sizeof(key_lens[0]); i++)
+        bench_tree(key_lens[i]);
+
+    bench_tokenizer();
+    bench_cmd_line_alloc();
+    bench_expansion();
+    bench_let();
+    bench_image();
+    bench_warm();
+
+    return 0;
+}